@@ -0,0 +1,82 @@
+//
+//  api.cpp
+//  rleduce
+//
+
+#include <stdexcept>
+#include "libGraphite/quickdraw/pict.hpp"
+#include "arena.hpp"
+#include "api.hpp"
+using namespace graphite;
+
+static std::shared_ptr<data::data> copyData(const char* bytes, size_t size) {
+    return makeData(std::vector<char>(bytes, bytes + size));
+}
+
+static std::vector<char> dataVector(std::shared_ptr<data::data> data) {
+    return std::vector<char>(dataBytes(data), dataBytes(data) + data->size());
+}
+
+static bool optimize(const Engine& engine, const char* type, int64_t (*process)(const Engine&, ResourcePayload&, Result&),
+                     const char* bytes, size_t size, std::vector<char>& output) {
+    ResourcePayload payload;
+    payload.type = type;
+    payload.bytes = bytes;
+    payload.size = size;
+    Result result;
+    process(engine, payload, result);
+    if (!payload.output) {
+        return false;
+    }
+    output = dataVector(payload.output);
+    return true;
+}
+
+bool optimizeRle(const Engine& engine, const char* bytes, size_t size, std::vector<char>& output) {
+    return optimize(engine, "rlëD", processRle, bytes, size, output);
+}
+
+bool optimizePict(const Engine& engine, const char* bytes, size_t size, std::vector<char>& output) {
+    return optimize(engine, "PICT", processPict, bytes, size, output);
+}
+
+std::vector<SpriteLayer> spriteLayers(const std::string& typeCode, const char* bytes, size_t size) {
+    return spriteLayers(typeCode, copyData(bytes, size));
+}
+
+std::vector<char> encodeSprite(const Engine& engine, const SpriteLayer& layer,
+                               const char* sprite, size_t spriteSize, const char* mask, size_t maskSize) {
+    ArenaScope scope;
+    auto frame = layer.frame;
+    if (frame.width() <= 0 || frame.height() <= 0) {
+        throw std::invalid_argument("Invalid frame size");
+    }
+    auto spriteImage = qd::pict(copyData(sprite, spriteSize));
+    auto spriteSurface = spriteImage.image_surface().lock();
+    auto size = spriteSurface->size();
+    if (size.width() % frame.width() != 0 || size.height() % frame.height() != 0) {
+        throw std::invalid_argument("Sprite PICT does not match frame size");
+    }
+    auto maskSurface = qd::pict(copyData(mask, maskSize)).image_surface().lock();
+    if (!(maskSurface->size() == size)) {
+        throw std::invalid_argument("Mask PICT does not match sprite size");
+    }
+    return dataVector(encodeSheets(engine, spriteSurface, spriteImage.format(), maskSurface, frame));
+}
+
+void decodeSprite(const Engine& engine, const SpriteLayer& layer, const char* rle, size_t size,
+                  std::vector<char>& sprite, std::vector<char>& mask) {
+    ArenaScope scope;
+    if (layer.gridX <= 0) {
+        throw std::invalid_argument("Invalid grid size");
+    }
+    auto image = qd::rle(copyData(rle, size), 0, "", layer.gridX);
+    if (!(layer.frame == image.frame_size())) {
+        throw std::invalid_argument("rlëD does not match frame size");
+    }
+    std::shared_ptr<data::data> spriteData;
+    std::shared_ptr<data::data> maskData;
+    decodeSheets(image, spriteData, maskData, engine.options.verify);
+    sprite = dataVector(spriteData);
+    mask = dataVector(maskData);
+}
@@ -0,0 +1,33 @@
+//
+//  api.hpp
+//  rleduce
+//
+//  In-memory entry points for embedding rleduce. These work on resource data alone, without a file, and don't
+//  touch any global state, so they may be called concurrently from any number of threads sharing an engine.
+//  Invalid data is reported by throwing.
+//
+
+#ifndef api_hpp
+#define api_hpp
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "rleduce.hpp"
+
+// Optimize an rlëD as -c/-t would, or a PICT as -p/-r would. Returns true and sets the output if the resource
+// should be replaced with it, otherwise the output is left as it was.
+bool optimizeRle(const Engine& engine, const char* bytes, size_t size, std::vector<char>& output);
+bool optimizePict(const Engine& engine, const char* bytes, size_t size, std::vector<char>& output);
+
+// The sprite layers of a spïn or shän's data, with the IDs of the PICTs or rlëD each one uses
+std::vector<SpriteLayer> spriteLayers(const std::string& typeCode, const char* bytes, size_t size);
+
+// Encode a layer from spriteLayers() into an rlëD, given its sprite and mask PICTs, as -e would
+std::vector<char> encodeSprite(const Engine& engine, const SpriteLayer& layer,
+                               const char* sprite, size_t spriteSize, const char* mask, size_t maskSize);
+// Decode a layer's rlëD into its sprite and mask PICTs, as -d would
+void decodeSprite(const Engine& engine, const SpriteLayer& layer, const char* rle, size_t size,
+                  std::vector<char>& sprite, std::vector<char>& mask);
+
+#endif /* api_hpp */
@@ -0,0 +1,80 @@
+//
+//  arena.cpp
+//  rleduce
+//
+
+#include <algorithm>
+#include <atomic>
+#include "arena.hpp"
+
+static constexpr size_t minimumBlock = 64 * 1024;
+
+static std::atomic<int64_t> allocated{0};
+static std::atomic<int64_t> heapBlocks{0};
+static std::atomic<int64_t> heapBytes{0};
+
+Arena& Arena::local() {
+    static thread_local Arena arena;
+    return arena;
+}
+
+Arena::Statistics Arena::statistics() {
+    Statistics statistics;
+    statistics.allocations = allocated;
+    statistics.blocks = heapBlocks;
+    statistics.reserved = heapBytes;
+    return statistics;
+}
+
+void Arena::addBlock(size_t size) {
+    heapBlocks++;
+    heapBytes += size;
+    blocks.push_back({std::make_unique<char[]>(size), size});
+}
+
+void* Arena::allocate(size_t size, size_t alignment) {
+    allocated++;
+    // Use the rest of the current block if it fits, otherwise the next free block that's big enough
+    for (; current < blocks.size(); current++, offset = 0) {
+        auto& block = blocks[current];
+        auto base = reinterpret_cast<uintptr_t>(block.bytes.get());
+        auto start = (base + offset + alignment - 1) / alignment * alignment - base;
+        if (start + size <= block.size) {
+            offset = start + size;
+            return block.bytes.get() + start;
+        }
+    }
+    auto last = blocks.empty() ? 0 : blocks.back().size;
+    addBlock(std::max({ size + alignment, minimumBlock, last * 2 }));
+    current = blocks.size() - 1;
+    auto& block = blocks[current];
+    auto base = reinterpret_cast<uintptr_t>(block.bytes.get());
+    auto start = (base + alignment - 1) / alignment * alignment - base;
+    offset = start + size;
+    return block.bytes.get() + start;
+}
+
+void Arena::release(void* pointer, size_t size) {
+    if (current < blocks.size() && static_cast<char*>(pointer) + size == blocks[current].bytes.get() + offset) {
+        offset -= size;
+    }
+}
+
+Arena::Mark Arena::mark() const {
+    return { current, offset };
+}
+
+void Arena::rewind(Mark mark) {
+    current = mark.block;
+    offset = mark.offset;
+    // Once everything is released, merge the blocks so the next resource fits in one
+    if (current == 0 && offset == 0 && blocks.size() > 1) {
+        size_t total = 0;
+        for (auto& block : blocks) {
+            total += block.size;
+        }
+        heapBytes -= total;
+        blocks.clear();
+        addBlock(total);
+    }
+}
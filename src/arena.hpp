@@ -0,0 +1,102 @@
+//
+//  arena.hpp
+//  rleduce
+//
+
+#ifndef arena_hpp
+#define arena_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Per-thread bump allocator for transient buffers.
+// Allocations are released together by rewinding to a mark, and the memory is kept for the next resource,
+// so once a thread has processed a resource of a given size it stops going to the heap for its scratch buffers.
+class Arena {
+public:
+    typedef struct Mark {
+        size_t block = 0;
+        size_t offset = 0;
+    } Mark;
+
+    typedef struct Statistics {
+        // Allocations served by arenas
+        int64_t allocations = 0;
+        // Blocks taken from the heap to serve them
+        int64_t blocks = 0;
+        // Bytes held across all arenas
+        int64_t reserved = 0;
+    } Statistics;
+
+    // The arena for the calling thread
+    static Arena& local();
+    static Statistics statistics();
+
+    void* allocate(size_t size, size_t alignment);
+    // Give back the most recent allocation, so a growing vector can reuse its space. Anything else is ignored.
+    void release(void* pointer, size_t size);
+
+    Mark mark() const;
+    // Release everything allocated since the mark
+    void rewind(Mark mark);
+
+private:
+    typedef struct Block {
+        std::unique_ptr<char[]> bytes;
+        size_t size;
+    } Block;
+
+    void addBlock(size_t size);
+
+    std::vector<Block> blocks;
+    size_t current = 0;
+    size_t offset = 0;
+};
+
+// Releases everything allocated on this thread's arena during its lifetime.
+// Scratch buffers must not outlive the innermost scope they were allocated in.
+class ArenaScope {
+public:
+    ArenaScope() : arena(Arena::local()), start(arena.mark()) {}
+    ~ArenaScope() { arena.rewind(start); }
+    ArenaScope(const ArenaScope&) = delete;
+
+private:
+    Arena& arena;
+    Arena::Mark start;
+};
+
+// Standard allocator over the arena of the thread that creates it
+template <typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+
+    ArenaAllocator() : arena(&Arena::local()) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t count) {
+        return static_cast<T*>(arena->allocate(count * sizeof(T), alignof(T)));
+    }
+    void deallocate(T* pointer, size_t count) {
+        arena->release(pointer, count * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+
+private:
+    template <typename U> friend class ArenaAllocator;
+    Arena* arena;
+};
+
+// A vector in the arena. It must be used and destroyed on the thread that created it, within its scope.
+template <typename T>
+using ScratchVector = std::vector<T, ArenaAllocator<T>>;
+
+#endif /* arena_hpp */
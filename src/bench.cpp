@@ -0,0 +1,433 @@
+//
+//  bench.cpp
+//  rleduce
+//
+//  Times the codecs on their own over a synthetic corpus, to catch regressions and compare changes.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <random>
+#include "libGraphite/data/writer.hpp"
+#include "libGraphite/quickdraw/pict.hpp"
+#include "libGraphite/quickdraw/rle.hpp"
+#include "libGraphite/rsrc/file.hpp"
+#include "rleduce.hpp"
+using namespace graphite;
+
+// Every allocation is counted, so each benchmark can report allocations per resource
+static std::atomic<uint64_t> allocations{0};
+
+void* operator new(size_t size) {
+    allocations++;
+    if (auto p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+typedef struct CorpusOptions {
+    int sprites = 8;
+    int frames = 36;
+    int width = 64;
+    int height = 64;
+    int depth = 24;
+    bool shan = false;
+    uint32_t seed = 1;
+} CorpusOptions;
+
+typedef struct Sprite {
+    int16_t id;
+    int16_t spriteID;
+    int16_t maskID;
+    int16_t gridX;
+    int frames;
+    std::shared_ptr<qd::surface> sheet;
+    std::shared_ptr<data::data> sprite;
+    std::shared_ptr<data::data> mask;
+    std::shared_ptr<data::data> rle;
+    std::shared_ptr<data::data> layout;
+} Sprite;
+
+typedef struct Corpus {
+    CorpusOptions options;
+    std::vector<Sprite> sprites;
+} Corpus;
+
+// Grid width used when decoding a shän, so the sheets match what rleduce produces
+static int16_t gridWidth(int frames) {
+    int16_t gridX = 6;
+    if (frames <= gridX) {
+        return frames;
+    }
+    while (frames % gridX != 0) {
+        gridX += 1;
+    }
+    return gridX;
+}
+
+// A rotating ship-like blob per frame, with a limited palette for 8-bit PICTs and per-pixel noise otherwise
+// so dithering and depth reduction have real work to do
+static std::shared_ptr<qd::surface> spriteSheet(const CorpusOptions& options, int16_t gridX, std::mt19937& rng) {
+    int rows = (options.frames + gridX - 1) / gridX;
+    auto sheet = std::make_shared<qd::surface>(gridX * options.width, rows * options.height);
+    int colours = options.depth <= 8 ? 64 : 256;
+    std::uniform_int_distribution<int> noise(-12, 12);
+    auto hue = rng() % colours;
+    for (int frame=0; frame<options.frames; frame++) {
+        auto angle = frame * 2 * M_PI / options.frames;
+        auto left = (frame % gridX) * options.width;
+        auto top = (frame / gridX) * options.height;
+        for (int y=0; y<options.height; y++) {
+            for (int x=0; x<options.width; x++) {
+                double dx = (x - options.width / 2.0) / (options.width / 2.0);
+                double dy = (y - options.height / 2.0) / (options.height / 2.0);
+                double u = dx * cos(angle) + dy * sin(angle);
+                double v = dy * cos(angle) - dx * sin(angle);
+                if (u * u / 0.8 + v * v / 0.3 > 0.8) {
+                    continue;
+                }
+                int band = static_cast<int>((u + 1) * 8) + frame;
+                int value = static_cast<int>((hue + band * 7) % colours) * 256 / colours;
+                if (options.depth > 8) {
+                    value = std::clamp(value + noise(rng), 0, 255);
+                }
+                sheet->set(left + x, top + y, qd::color(value, 255 - value, (value * 3) & 0xFF));
+            }
+        }
+    }
+    return sheet;
+}
+
+static std::shared_ptr<qd::surface> maskSheet(std::shared_ptr<qd::surface> sheet) {
+    auto size = sheet->size();
+    auto mask = std::make_shared<qd::surface>(size.width(), size.height(), qd::color::black());
+    for (int y=0; y<size.height(); y++) {
+        for (int x=0; x<size.width(); x++) {
+            if (sheet->at(x, y).alpha_component()) {
+                mask->set(x, y, qd::color::white());
+            }
+        }
+    }
+    return mask;
+}
+
+// The sprite sheet is opaque black wherever the mask is, as a PICT would be
+static std::shared_ptr<qd::surface> opaqueSheet(std::shared_ptr<qd::surface> sheet) {
+    auto size = sheet->size();
+    auto opaque = std::make_shared<qd::surface>(size.width(), size.height(), qd::color::black());
+    for (int y=0; y<size.height(); y++) {
+        for (int x=0; x<size.width(); x++) {
+            auto colour = sheet->at(x, y);
+            if (colour.alpha_component()) {
+                opaque->set(x, y, colour);
+            }
+        }
+    }
+    return opaque;
+}
+
+static std::shared_ptr<data::data> spinData(const CorpusOptions& options, const Sprite& sprite) {
+    data::writer writer;
+    writer.write_short(sprite.spriteID);
+    writer.write_short(sprite.maskID);
+    writer.write_short(options.width);
+    writer.write_short(options.height);
+    writer.write_short(sprite.gridX);
+    writer.write_short((sprite.frames + sprite.gridX - 1) / sprite.gridX);
+    return writer.data();
+}
+
+// Only the base layer is used, all other layers have no sprite
+static std::shared_ptr<data::data> shanData(const CorpusOptions& options, const Sprite& sprite) {
+    data::writer writer;
+    writer.write_short(sprite.spriteID);
+    writer.write_short(sprite.maskID);
+    writer.write_short(1);
+    writer.write_short(options.width);
+    writer.write_short(options.height);
+    // Alt, engine, light and weapon layers, then frames per set at offset 52
+    for (int i=0; i<21; i++) {
+        writer.write_short(0);
+    }
+    writer.write_short(sprite.frames);
+    // Shield layer
+    for (int i=0; i<9; i++) {
+        writer.write_short(0);
+    }
+    return writer.data();
+}
+
+static Corpus buildCorpus(const CorpusOptions& options) {
+    Corpus corpus;
+    corpus.options = options;
+    std::mt19937 rng(options.seed);
+    for (int i=0; i<options.sprites; i++) {
+        Sprite sprite;
+        sprite.id = 128 + i;
+        sprite.spriteID = 1000 + i * 2;
+        sprite.maskID = sprite.spriteID + 1;
+        sprite.frames = options.frames;
+        sprite.gridX = gridWidth(options.frames);
+        sprite.sheet = spriteSheet(options, sprite.gridX, rng);
+        sprite.sprite = qd::pict(opaqueSheet(sprite.sheet)).data(options.depth);
+        sprite.mask = qd::pict(maskSheet(sprite.sheet)).data(options.depth);
+        sprite.rle = qd::rle(sprite.sheet, qd::size(options.width, options.height)).data();
+        sprite.layout = options.shan ? shanData(options, sprite) : spinData(options, sprite);
+        corpus.sprites.push_back(sprite);
+    }
+    return corpus;
+}
+
+// A resource file holding either the PICT pairs or the rlëDs, along with the spïns/shäns
+static rsrc::file corpusFile(const Corpus& corpus, bool rles) {
+    rsrc::file file;
+    auto layout = corpus.options.shan ? "shän" : "spïn";
+    for (auto& sprite : corpus.sprites) {
+        file.add_resource(layout, sprite.id, "", sprite.layout);
+        if (rles) {
+            file.add_resource("rlëD", sprite.spriteID, "", sprite.rle);
+        } else {
+            file.add_resource("PICT", sprite.spriteID, "", sprite.sprite);
+            file.add_resource("PICT", sprite.maskID, "", sprite.mask);
+        }
+    }
+    return file;
+}
+
+typedef struct Workload {
+    int resources = 0;
+    int64_t bytes = 0;
+    int64_t pixels = 0;
+} Workload;
+
+typedef struct Measurement {
+    Workload work;
+    double seconds = 0;
+    uint64_t allocations = 0;
+} Measurement;
+
+// Run a benchmark several times. Setup is not timed and its allocations are not counted.
+static Measurement measure(int iterations, std::function<void()> setup, std::function<Workload()> body) {
+    Measurement total;
+    for (int i=0; i<iterations; i++) {
+        setup();
+        auto before = allocations.load();
+        auto start = std::chrono::steady_clock::now();
+        auto work = body();
+        auto end = std::chrono::steady_clock::now();
+        total.allocations += allocations.load() - before;
+        total.seconds += std::chrono::duration<double>(end - start).count();
+        total.work.resources += work.resources;
+        total.work.bytes += work.bytes;
+        total.work.pixels += work.pixels;
+    }
+    return total;
+}
+
+static void report(const std::string& name, const Measurement& m) {
+    auto seconds = std::max(m.seconds, 1e-9);
+    auto resources = std::max(m.work.resources, 1);
+    printf("%-14s  %9d  %11lld  %10lld  %9.2f  %8.2f  %9.2f  %12.1f\n", name.c_str(), m.work.resources,
+           static_cast<long long>(m.work.bytes), static_cast<long long>(m.work.pixels), m.seconds * 1000,
+           m.work.bytes / seconds / 1e6, m.work.pixels / seconds / 1e6,
+           static_cast<double>(m.allocations) / resources);
+}
+
+static int64_t framePixels(const Corpus& corpus) {
+    return static_cast<int64_t>(corpus.options.width) * corpus.options.height * corpus.options.frames;
+}
+
+static void runBenchmarks(const Engine& engine, const Corpus& corpus, int iterations) {
+    printf("Benchmark       Resources        Bytes      Pixels  Time (ms)      MB/s  Mpixels/s  Allocs/rsrc\n");
+    auto layout = corpus.options.shan ? "shän" : "spïn";
+    rsrc::file file;
+    Result result;
+
+    std::vector<ResourcePayload> payloads;
+    auto loadPayloads = [&](const char* type) {
+        file = corpusFile(corpus, type == std::string("rlëD"));
+        payloads.clear();
+        for (auto resource : file.type_container(type).lock()->resources()) {
+            payloads.push_back(resourcePayload(resource));
+        }
+    };
+
+    report("processRle", measure(iterations, [&] {
+        loadPayloads("rlëD");
+    }, [&] {
+        Workload work;
+        for (auto& payload : payloads) {
+            work.resources++;
+            work.bytes += payload.size;
+            work.pixels += framePixels(corpus);
+            processRle(engine, payload, result);
+        }
+        return work;
+    }));
+
+    report("processPict", measure(iterations, [&] {
+        loadPayloads("PICT");
+    }, [&] {
+        Workload work;
+        for (auto& payload : payloads) {
+            work.resources++;
+            work.bytes += payload.size;
+            work.pixels += framePixels(corpus);
+            processPict(engine, payload, result);
+        }
+        return work;
+    }));
+
+    std::vector<std::shared_ptr<qd::surface>> surfaces;
+    report("rgb555dither", measure(iterations, [&] {
+        surfaces.clear();
+        for (auto& sprite : corpus.sprites) {
+            surfaces.push_back(std::make_shared<qd::surface>(*sprite.sheet));
+        }
+    }, [&] {
+        Workload work;
+        for (auto surface : surfaces) {
+            work.resources++;
+            work.bytes += static_cast<int64_t>(surface->size().width()) * surface->size().height() * 4;
+            work.pixels += static_cast<int64_t>(surface->size().width()) * surface->size().height();
+            rgb555dither(surface);
+        }
+        return work;
+    }));
+
+    report("enRle", measure(iterations, [&] {
+        file = corpusFile(corpus, false);
+    }, [&] {
+        Workload work;
+        auto frame = qd::size(corpus.options.width, corpus.options.height);
+        for (auto& sprite : corpus.sprites) {
+            auto resource = file.find(layout, sprite.id, {}).lock();
+            // Only count sprites actually converted, so a no-op can't pass for a fast one
+            if (!enRle(engine, resource, file, sprite.spriteID, sprite.maskID, frame)) {
+                std::cerr << "enRle did not convert " << layout << " " << sprite.id << std::endl;
+                continue;
+            }
+            work.resources++;
+            work.bytes += sprite.sprite->size() + sprite.mask->size();
+            work.pixels += framePixels(corpus);
+        }
+        return work;
+    }));
+
+    report("deRle", measure(iterations, [&] {
+        file = corpusFile(corpus, true);
+    }, [&] {
+        Workload work;
+        auto frame = qd::size(corpus.options.width, corpus.options.height);
+        for (auto& sprite : corpus.sprites) {
+            auto resource = file.find(layout, sprite.id, {}).lock();
+            if (!deRle(engine, resource, file, sprite.spriteID, sprite.maskID, frame, sprite.gridX)) {
+                std::cerr << "deRle did not convert " << layout << " " << sprite.id << std::endl;
+                continue;
+            }
+            work.resources++;
+            work.bytes += sprite.rle->size();
+            work.pixels += framePixels(corpus);
+        }
+        return work;
+    }));
+}
+
+static void printUsage() {
+    std::cerr << "Usage: rleduce-bench [options]" << std::endl;
+    std::cerr << "  --sprites <count>     number of sprites in the corpus (default 8)" << std::endl;
+    std::cerr << "  --frames <count>      frames per sprite (default 36)" << std::endl;
+    std::cerr << "  --size <w>x<h>        frame size (default 64x64)" << std::endl;
+    std::cerr << "  --depth <bits>        PICT depth: 8, 16 or 24 (default 24)" << std::endl;
+    std::cerr << "  --shan                lay sprites out with shäns instead of spïns" << std::endl;
+    std::cerr << "  --iterations <count>  times to run each benchmark (default 5)" << std::endl;
+    std::cerr << "  --seed <value>        random seed for the corpus (default 1)" << std::endl;
+    std::cerr << "  --write <path>        also write the PICT and rlëD corpora as resource files" << std::endl;
+}
+
+int main(int argc, const char * argv[]) {
+    CorpusOptions corpusOptions;
+    int iterations = 5;
+    std::string writePath;
+    for (int i=1; i<argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "--shan") {
+            corpusOptions.shan = true;
+            continue;
+        }
+        if (++i == argc) {
+            std::cerr << "Unknown option or missing value: " << arg << std::endl;
+            printUsage();
+            return 1;
+        }
+        std::string value(argv[i]);
+        try {
+            if (arg == "--sprites") {
+                corpusOptions.sprites = std::stoi(value);
+            } else if (arg == "--frames") {
+                corpusOptions.frames = std::stoi(value);
+            } else if (arg == "--size") {
+                auto x = value.find('x');
+                corpusOptions.width = std::stoi(value.substr(0, x));
+                corpusOptions.height = x == std::string::npos ? corpusOptions.width : std::stoi(value.substr(x + 1));
+            } else if (arg == "--depth") {
+                corpusOptions.depth = std::stoi(value);
+            } else if (arg == "--iterations") {
+                iterations = std::stoi(value);
+            } else if (arg == "--seed") {
+                corpusOptions.seed = std::stoul(value);
+            } else if (arg == "--write") {
+                writePath = value;
+            } else {
+                std::cerr << "Unknown option: " << arg << std::endl;
+                printUsage();
+                return 1;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Invalid value for " << arg << ": " << value << std::endl;
+            return 1;
+        }
+    }
+    if (corpusOptions.sprites <= 0 || corpusOptions.frames <= 0 || corpusOptions.width <= 0 ||
+        corpusOptions.height <= 0 || iterations <= 0) {
+        std::cerr << "Counts and sizes must be positive." << std::endl;
+        return 1;
+    }
+
+    // The codecs run on a single thread here, so timings aren't affected by scheduling
+    Options options;
+    options.jobs = 1;
+    Engine engine(options);
+
+    auto corpus = buildCorpus(corpusOptions);
+    printf("Corpus: %d %s sprites, %d frames of %dx%d, %d-bit PICTs\n", corpusOptions.sprites,
+           corpusOptions.shan ? "shän" : "spïn", corpusOptions.frames, corpusOptions.width,
+           corpusOptions.height, corpusOptions.depth);
+    if (!writePath.empty()) {
+        try {
+            corpusFile(corpus, false).write(writePath + "-picts.ndat", rsrc::file::classic);
+            corpusFile(corpus, true).write(writePath + "-rles.ndat", rsrc::file::classic);
+        } catch (const std::exception& e) {
+            std::cerr << writePath << ": " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    runBenchmarks(engine, corpus, iterations);
+    return 0;
+}
@@ -0,0 +1,108 @@
+//
+//  cache.cpp
+//  rleduce
+//
+
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include "cache.hpp"
+
+static const char magic[4] = { 'r', 'l', 'd', 'c' };
+
+static void writeLong(std::vector<char>& out, uint64_t value, int bytes) {
+    for (int i=bytes-1; i>=0; i--) {
+        out.push_back(static_cast<char>(value >> (i * 8)));
+    }
+}
+
+static uint64_t readLong(const std::vector<char>& in, size_t& pos, int bytes) {
+    uint64_t value = 0;
+    for (int i=0; i<bytes; i++) {
+        value = value << 8 | static_cast<uint8_t>(in[pos++]);
+    }
+    return value;
+}
+
+ResultCache::ResultCache(std::filesystem::path directory) : directory(directory) {
+    std::filesystem::create_directories(directory);
+}
+
+std::filesystem::path ResultCache::path(uint64_t key) const {
+    char name[24];
+    snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+    return directory / name;
+}
+
+bool ResultCache::load(const ResultKey& key, CacheEntry& entry) {
+    // Layout: magic, input check and size, write flag, 4 info values, data length, data
+    static const size_t headerSize = 4 + 2 * 8 + 1 + 4 * 8 + 4;
+    std::ifstream file(path(key.hash), std::ios::binary | std::ios::ate);
+    if (!file) {
+        missCount++;
+        return false;
+    }
+    auto size = static_cast<size_t>(file.tellg());
+    std::vector<char> bytes(size);
+    file.seekg(0);
+    if (size < headerSize || !file.read(bytes.data(), size) || !std::equal(magic, magic + 4, bytes.begin())) {
+        missCount++;
+        return false;
+    }
+    size_t pos = 4;
+    auto check = readLong(bytes, pos, 8);
+    auto inputSize = readLong(bytes, pos, 8);
+    if (check != key.check || inputSize != key.size) {
+        // Another input with the same hash
+        missCount++;
+        return false;
+    }
+    entry.write = bytes[pos++] != 0;
+    for (auto& value : entry.info) {
+        value = static_cast<int64_t>(readLong(bytes, pos, 8));
+    }
+    auto length = readLong(bytes, pos, 4);
+    if (pos + length != size) {
+        missCount++;
+        return false;
+    }
+    entry.data.assign(bytes.begin() + pos, bytes.end());
+    hitCount++;
+    return true;
+}
+
+void ResultCache::store(const ResultKey& key, const CacheEntry& entry) {
+    std::vector<char> bytes(magic, magic + 4);
+    writeLong(bytes, key.check, 8);
+    writeLong(bytes, key.size, 8);
+    bytes.push_back(entry.write ? 1 : 0);
+    for (auto value : entry.info) {
+        writeLong(bytes, static_cast<uint64_t>(value), 8);
+    }
+    writeLong(bytes, entry.data.size(), 4);
+    bytes.insert(bytes.end(), entry.data.begin(), entry.data.end());
+
+    // Write to a unique temporary file then move it into place, so readers never see a partial entry
+    auto target = path(key.hash);
+    auto temp = target;
+    temp += "." + std::to_string(std::random_device()()) + ".tmp";
+    {
+        std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+        if (!file.write(bytes.data(), bytes.size())) {
+            return;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temp, target, error);
+    if (error) {
+        std::filesystem::remove(temp, error);
+    }
+}
+
+size_t ResultCache::hits() const {
+    return hitCount;
+}
+
+size_t ResultCache::misses() const {
+    return missCount;
+}
@@ -0,0 +1,57 @@
+//
+//  cache.hpp
+//  rleduce
+//
+
+#ifndef cache_hpp
+#define cache_hpp
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+// Identifies a resource's result. The hash picks the entry, and the size and a second, independent hash of the
+// same input are compared before reusing it, so two inputs whose hashes collide don't share a result.
+typedef struct ResultKey {
+    uint64_t hash = 0;
+    uint64_t check = 0;
+    uint64_t size = 0;
+
+    bool operator==(const ResultKey& other) const {
+        return hash == other.hash && check == other.check && size == other.size;
+    }
+} ResultKey;
+
+// A previously computed result for a resource.
+typedef struct CacheEntry {
+    // Whether the result replaces the resource data
+    bool write = false;
+    // Codec specific details needed for reporting, such as formats and sizes
+    std::array<int64_t, 4> info = {};
+    // The new resource data, present when write is set
+    std::vector<char> data;
+} CacheEntry;
+
+// On-disk cache of optimized resources, keyed on a hash of the input data and the options that affect it.
+// Each entry is a separate file, written atomically, so the cache can be shared by concurrent workers and runs.
+class ResultCache {
+public:
+    explicit ResultCache(std::filesystem::path directory);
+
+    bool load(const ResultKey& key, CacheEntry& entry);
+    void store(const ResultKey& key, const CacheEntry& entry);
+
+    size_t hits() const;
+    size_t misses() const;
+
+private:
+    std::filesystem::path directory;
+    std::atomic<size_t> hitCount{0};
+    std::atomic<size_t> missCount{0};
+
+    std::filesystem::path path(uint64_t key) const;
+};
+
+#endif /* cache_hpp */
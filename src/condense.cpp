@@ -0,0 +1,603 @@
+//
+//  condense.cpp
+//  rleduce
+//
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <tuple>
+#include "arena.hpp"
+#include "condense.hpp"
+#include "hash.hpp"
+
+static const size_t headerSize = 16;
+
+static uint32_t readLong(const char* bytes, size_t size, size_t pos) {
+    if (pos + 4 > size) {
+        throw std::out_of_range("Unexpected end of rlëD data");
+    }
+    auto p = reinterpret_cast<const uint8_t*>(bytes + pos);
+    return p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static int16_t readShort(const char* bytes, size_t size, size_t pos) {
+    if (pos + 2 > size) {
+        throw std::out_of_range("Unexpected end of rlëD data");
+    }
+    auto p = reinterpret_cast<const uint8_t*>(bytes + pos);
+    return static_cast<int16_t>(p[0] << 8 | p[1]);
+}
+
+// Figure out how many lines can be trimmed from top/bottom of the whole sprite
+static int trimLines(const char* bytes, size_t size, int16_t height, int16_t frames) {
+    int trim = height/2;
+    size_t pos = headerSize;
+    for (int i=0; i<frames; i++) {
+        int line = 0;
+        int top = height;
+        int bottom = 0;
+        while (true) {
+            auto op = readLong(bytes, size, pos);
+            pos += 4;
+            if (static_cast<rleop>(op >> 24) != line_start) {
+                break;
+            }
+            auto count = op & 0x00FFFFFF;
+            if (count != 0) {
+                pos += count;
+                if (top > line) {
+                    top = line;
+                }
+                bottom = line+1;
+            }
+            line++;
+        }
+        if (top < trim) {
+            trim = top;
+        }
+        bottom = height-bottom;
+        if (bottom < trim) {
+            trim = bottom;
+        }
+    }
+    return trim;
+}
+
+// Re-encodes a single 16-bit line using the fewest bytes of opcodes.
+// The scratch space is kept between lines to avoid allocating for each one, and comes from the
+// thread's arena so it is reused between resources too.
+class LineEncoder {
+public:
+    static constexpr int32_t transparent = -1;
+
+    // Encode the ops of a line (excluding its line_start) into line(). Returns false if they can't be decoded.
+    bool encode(const char* bytes, size_t start, size_t end);
+    // Decode the ops of a line into decoded(), without any trailing transparent pixels
+    bool decode(const char* bytes, size_t start, size_t end);
+    const ScratchVector<int32_t>& decoded() const { return pixels; }
+    // Encode a line of rgb555 pixels, or transparent, into line()
+    void encode(const int32_t* values, size_t count);
+    const ScratchVector<char>& line() const { return out; }
+
+private:
+    ScratchVector<int32_t> pixels;
+    ScratchVector<int> cost;
+    ScratchVector<int> odd;
+    ScratchVector<int> even;
+    ScratchVector<int> from;
+    ScratchVector<bool> opened;
+    // Pixel run or not, first and last pixel, found in reverse
+    ScratchVector<std::tuple<bool, size_t, size_t>> ops;
+    ScratchVector<char> out;
+
+    void encodePixels();
+    void encodeOpaque(size_t start, size_t end);
+    void writeLong(uint32_t value);
+};
+
+bool LineEncoder::decode(const char* bytes, size_t start, size_t end) {
+    pixels.clear();
+    size_t pos = start;
+    while (pos < end) {
+        auto op = readLong(bytes, end, pos);
+        auto count = op & 0x00FFFFFF;
+        pos += 4;
+        if (count % 2) {
+            return false;
+        }
+        switch (static_cast<rleop>(op >> 24)) {
+            case pixel_data:
+                for (size_t i=0; i<count; i+=2) {
+                    pixels.push_back(static_cast<uint16_t>(readShort(bytes, end, pos + i)));
+                }
+                pos += (count + 3) & ~3;
+                break;
+            case transparent_run:
+                pixels.insert(pixels.end(), count / 2, transparent);
+                break;
+            case pixel_run: {
+                auto run = readLong(bytes, end, pos);
+                for (size_t i=0; i<count; i+=4) {
+                    pixels.push_back(run >> 16);
+                    if (i+2 < count) {
+                        pixels.push_back(run & 0xFFFF);
+                    }
+                }
+                pos += 4;
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    // Anything after the last opaque pixel is transparent anyway
+    while (!pixels.empty() && pixels.back() == transparent) {
+        pixels.pop_back();
+    }
+    return pos == end;
+}
+
+void LineEncoder::writeLong(uint32_t value) {
+    out.push_back(static_cast<char>(value >> 24));
+    out.push_back(static_cast<char>(value >> 16));
+    out.push_back(static_cast<char>(value >> 8));
+    out.push_back(static_cast<char>(value));
+}
+
+// Shortest path over the opaque pixels in [start, end). cost[i] is the fewest bytes to encode the first
+// i pixels with an op ending at i. A pixel_data op can also be left open, with an odd or even number of
+// pixels so far, since a pixel in an odd position costs a whole padded word. A pixel_run covers any
+// stretch where every other pixel repeats, for a fixed 8 bytes.
+void LineEncoder::encodeOpaque(size_t start, size_t end) {
+    static const int unreachable = 1 << 30;
+    auto length = end - start;
+    auto value = pixels.data() + start;
+    cost.assign(length + 1, unreachable);
+    odd.assign(length + 1, unreachable);
+    even.assign(length + 1, unreachable);
+    from.assign(length + 1, -1);
+    opened.assign(length + 1, false);
+    cost[0] = 0;
+    // The cheapest place to start a pixel_run that reaches the current pixel
+    size_t runStart = 0;
+    for (size_t i=0; i<length; i++) {
+        if (i >= 2 && value[i] != value[i-2]) {
+            runStart = cost[i-1] <= cost[i] ? i-1 : i;
+        } else if (cost[i] < cost[runStart]) {
+            runStart = i;
+        }
+        opened[i+1] = cost[i] + 4 <= even[i];
+        odd[i+1] = std::min(cost[i] + 4, even[i]) + 4;
+        even[i+1] = odd[i];
+        cost[i+1] = std::min(odd[i+1], even[i+1]);
+        if (cost[runStart] + 8 < cost[i+1]) {
+            cost[i+1] = cost[runStart] + 8;
+            from[i+1] = static_cast<int>(runStart);
+        }
+    }
+
+    // Walk back to find the ops, then write them in order
+    ops.clear();
+    size_t i = length;
+    while (i > 0) {
+        if (from[i] >= 0) {
+            ops.emplace_back(true, from[i], i);
+            i = from[i];
+            continue;
+        }
+        // An open pixel_data op, back to where it was opened
+        bool isOdd = odd[i] <= even[i];
+        auto dataEnd = i;
+        while (true) {
+            if (isOdd && opened[i]) {
+                i--;
+                break;
+            }
+            isOdd = !isOdd;
+            i--;
+        }
+        ops.emplace_back(false, i, dataEnd);
+    }
+    for (auto op = ops.rbegin(); op != ops.rend(); op++) {
+        auto [run, first, last] = *op;
+        auto count = static_cast<uint32_t>((last - first) * 2);
+        if (run) {
+            writeLong(pixel_run << 24 | count);
+            auto second = last - first > 1 ? value[first+1] : value[first];
+            writeLong(static_cast<uint32_t>(value[first]) << 16 | static_cast<uint32_t>(second));
+        } else {
+            writeLong(pixel_data << 24 | count);
+            for (auto p=first; p<last; p++) {
+                out.push_back(static_cast<char>(value[p] >> 8));
+                out.push_back(static_cast<char>(value[p]));
+            }
+            if (count % 4) {
+                out.insert(out.end(), 2, 0);
+            }
+        }
+    }
+}
+
+bool LineEncoder::encode(const char* bytes, size_t start, size_t end) {
+    out.clear();
+    if (!decode(bytes, start, end)) {
+        return false;
+    }
+    encodePixels();
+    return true;
+}
+
+void LineEncoder::encode(const int32_t* values, size_t count) {
+    out.clear();
+    while (count > 0 && values[count-1] == transparent) {
+        count--;
+    }
+    pixels.assign(values, values + count);
+    encodePixels();
+}
+
+void LineEncoder::encodePixels() {
+    // Transparent stretches are always a single run, so the opaque stretches between them are independent
+    size_t pos = 0;
+    while (pos < pixels.size()) {
+        auto next = pos;
+        bool clear = pixels[pos] == transparent;
+        while (next < pixels.size() && (pixels[next] == transparent) == clear) {
+            next++;
+        }
+        if (clear) {
+            writeLong(transparent_run << 24 | static_cast<uint32_t>((next - pos) * 2));
+        } else {
+            encodeOpaque(pos, next);
+        }
+        pos = next;
+    }
+}
+
+// Walk the frames and pass each line that is kept to the sink, either as a span of the input or as new bytes.
+// With an encoder, each line is replaced by its re-encoding when that is smaller.
+template <typename Sink>
+static void walkFrames(const char* bytes, size_t size, int16_t frames, int trim, LineEncoder* encoder, Sink& sink) {
+    static const char zero[4] = { 0, 0, 0, 0 };
+    static const char emptyLine[4] = { line_start, 0, 0, 0 };
+    // Empty lines seen since the last line with pixels, by position in the input or 0 if re-encoded as empty
+    ScratchVector<size_t> blank;
+    size_t pos = headerSize;
+    for (int i=0; i<frames; i++) {
+        // Skip the trimmed lines at the top, these are all empty
+        int skip = trim;
+        uint32_t op = readLong(bytes, size, pos);
+        while (static_cast<rleop>(op >> 24) == line_start && skip-- > 0) {
+            pos += 4;
+            op = readLong(bytes, size, pos);
+        }
+        blank.clear();
+        while (true) {
+            op = readLong(bytes, size, pos);
+            if (static_cast<rleop>(op >> 24) != line_start) {
+                break;
+            }
+            auto count = op & 0x00FFFFFF;
+            if (count == 0) {
+                blank.push_back(pos);
+                pos += 4;
+                continue;
+            }
+            auto end = pos + 4 + count;
+            if (end > size) {
+                throw std::out_of_range("Unexpected end of rlëD data");
+            }
+            bool reencoded = false;
+            if (encoder && encoder->encode(bytes, pos + 4, end) && encoder->line().size() < count) {
+                if (encoder->line().empty()) {
+                    blank.push_back(0);
+                    pos = end;
+                    continue;
+                }
+                reencoded = true;
+            }
+            // Any preceding empty lines are kept, along with this one
+            for (auto line : blank) {
+                if (line) {
+                    sink.span(line, line + 4);
+                } else {
+                    sink.literal(emptyLine, 4);
+                }
+            }
+            blank.clear();
+            if (reencoded) {
+                auto& line = encoder->line();
+                uint32_t start = line_start << 24 | static_cast<uint32_t>(line.size());
+                char header[4] = {
+                    static_cast<char>(start >> 24), static_cast<char>(start >> 16),
+                    static_cast<char>(start >> 8), static_cast<char>(start)
+                };
+                sink.literal(header, 4);
+                sink.literal(line.data(), line.size());
+            } else {
+                sink.span(pos, end);
+            }
+            pos = end;
+        }
+        // Trailing empty lines are dropped. The eof op can be kept as is only if it's a plain zero.
+        if (op == 0) {
+            sink.span(pos, pos + 4);
+        } else {
+            sink.literal(zero, 4);
+        }
+        pos += 4;
+    }
+}
+
+// Adds up the size of the output
+class MeasureSink {
+public:
+    size_t size = 0;
+    void span(size_t start, size_t end) { size += end - start; }
+    void literal(const char*, size_t count) { size += count; }
+};
+
+// Writes the output, coalescing adjacent spans so unchanged frames are copied together
+class CopySink {
+public:
+    CopySink(const char* bytes, char* out, size_t written) : bytes(bytes), out(out), written(written) {}
+
+    void span(size_t start, size_t end) {
+        if (start != pendingEnd) {
+            flush();
+            pendingStart = start;
+        }
+        pendingEnd = end;
+    }
+
+    void literal(const char* data, size_t count) {
+        flush();
+        memcpy(out + written, data, count);
+        written += count;
+    }
+
+    size_t finish() {
+        flush();
+        return written;
+    }
+
+private:
+    const char* bytes;
+    char* out;
+    size_t written;
+    size_t pendingStart = 0;
+    size_t pendingEnd = 0;
+
+    void flush() {
+        memcpy(out + written, bytes + pendingStart, pendingEnd - pendingStart);
+        written += pendingEnd - pendingStart;
+        pendingStart = pendingEnd = 0;
+    }
+};
+
+RleCondensed condenseRle(const char* bytes, size_t size, bool trim, bool reencode) {
+    RleCondensed result;
+    result.height = readShort(bytes, size, 2);
+    result.frames = readShort(bytes, size, 8);
+    auto lines = trim ? trimLines(bytes, size, result.height, result.frames) : 0;
+    result.newHeight = result.height - (lines * 2);
+    // Only 16-bit pixels are understood by the encoder
+    LineEncoder encoder;
+    auto lineEncoder = reencode && readShort(bytes, size, 4) == 16 ? &encoder : nullptr;
+
+    // Measure first so nothing is copied when there's nothing to remove. Re-encoding is too costly to do
+    // twice, but the output is never larger than the input so it can be written directly.
+    if (!lineEncoder) {
+        MeasureSink measure;
+        measure.size = headerSize;
+        walkFrames(bytes, size, result.frames, lines, nullptr, measure);
+        result.size = measure.size;
+        if (result.size >= size) {
+            return result;
+        }
+    }
+
+    result.data.resize(lineEncoder ? size : result.size);
+    auto out = result.data.data();
+    memcpy(out, bytes, headerSize);
+    out[2] = static_cast<char>(result.newHeight >> 8);
+    out[3] = static_cast<char>(result.newHeight);
+    CopySink copy(bytes, out, headerSize);
+    walkFrames(bytes, size, result.frames, lines, lineEncoder, copy);
+    result.size = copy.finish();
+    if (result.size >= size) {
+        result.data.clear();
+    } else {
+        result.data.resize(result.size);
+    }
+    return result;
+}
+
+// The ops of each line of a frame starting at pos, as offsets excluding the line_start. Leaves pos after the frame.
+static void frameLines(const char* bytes, size_t size, size_t& pos, ScratchVector<std::pair<size_t, size_t>>& lines) {
+    lines.clear();
+    while (true) {
+        auto op = readLong(bytes, size, pos);
+        pos += 4;
+        if (static_cast<rleop>(op >> 24) != line_start) {
+            return;
+        }
+        auto count = op & 0x00FFFFFF;
+        if (pos + count > size) {
+            throw std::out_of_range("Unexpected end of rlëD data");
+        }
+        lines.emplace_back(pos, pos + count);
+        pos += count;
+    }
+}
+
+bool sameRleFrames(const char* original, size_t originalSize, const char* condensed, size_t condensedSize) {
+    // Only the height in the header may change
+    if (originalSize < headerSize || condensedSize < headerSize || memcmp(original, condensed, 2) != 0 ||
+        memcmp(original + 4, condensed + 4, headerSize - 4) != 0) {
+        return false;
+    }
+    auto height = readShort(original, originalSize, 2);
+    auto newHeight = readShort(condensed, condensedSize, 2);
+    if (newHeight > height || (height - newHeight) % 2 != 0) {
+        return false;
+    }
+    size_t trim = (height - newHeight) / 2;
+    auto frames = readShort(original, originalSize, 8);
+    // Lines are compared as they're stored first, since condensing copies most of them unchanged.
+    // Re-encoded 16-bit lines are compared by their pixels.
+    bool decode = readShort(original, originalSize, 4) == 16;
+    LineEncoder before;
+    LineEncoder after;
+    ScratchVector<std::pair<size_t, size_t>> originalLines;
+    ScratchVector<std::pair<size_t, size_t>> condensedLines;
+    size_t pos = headerSize;
+    size_t newPos = headerSize;
+    for (int i=0; i<frames; i++) {
+        frameLines(original, originalSize, pos, originalLines);
+        frameLines(condensed, condensedSize, newPos, condensedLines);
+        if (condensedLines.size() > static_cast<size_t>(newHeight)) {
+            return false;
+        }
+        // Missing lines are empty, including the trimmed ones
+        auto lines = std::max(originalLines.size(), condensedLines.size() + trim);
+        for (size_t y=0; y<lines; y++) {
+            auto [start, end] = y < originalLines.size() ? originalLines[y] : std::make_pair(pos, pos);
+            auto [newStart, newEnd] = y >= trim && y - trim < condensedLines.size() ? condensedLines[y - trim] : std::make_pair(newPos, newPos);
+            if (end - start == newEnd - newStart && memcmp(original + start, condensed + newStart, end - start) == 0) {
+                continue;
+            }
+            if (!decode || !before.decode(original, start, end) || !after.decode(condensed, newStart, newEnd) ||
+                before.decoded() != after.decoded()) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool decodeRleFrame(const char* bytes, size_t size, size_t& pos, int width, int height, int32_t* values) {
+    std::fill(values, values + static_cast<size_t>(width) * height, LineEncoder::transparent);
+    LineEncoder decoder;
+    for (int line=0;; line++) {
+        auto op = readLong(bytes, size, pos);
+        pos += 4;
+        if (static_cast<rleop>(op >> 24) != line_start) {
+            return static_cast<rleop>(op >> 24) == eof;
+        }
+        auto count = op & 0x00FFFFFF;
+        if (line >= height || pos + count > size || !decoder.decode(bytes, pos, pos + count) ||
+            decoder.decoded().size() > static_cast<size_t>(width)) {
+            return false;
+        }
+        std::copy(decoder.decoded().begin(), decoder.decoded().end(), values + static_cast<size_t>(line) * width);
+        pos += count;
+    }
+}
+
+bool decodeRleFrames(const char* bytes, size_t size, ScratchVector<int32_t>& values) {
+    if (size < headerSize || readShort(bytes, size, 4) != 16) {
+        return false;
+    }
+    int width = readShort(bytes, size, 0);
+    int height = readShort(bytes, size, 2);
+    int frames = readShort(bytes, size, 8);
+    if (width <= 0 || height <= 0 || frames < 0) {
+        return false;
+    }
+    auto frameSize = static_cast<size_t>(width) * height;
+    values.resize(frames * frameSize);
+    size_t pos = headerSize;
+    for (int i=0; i<frames; i++) {
+        if (!decodeRleFrame(bytes, size, pos, width, height, values.data() + i * frameSize)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+RleIndex indexRle(const char* bytes, size_t size) {
+    RleIndex index;
+    index.height = readShort(bytes, size, 2);
+    index.size = static_cast<uint32_t>(size);
+    index.hash = hash64(bytes, size);
+    auto frames = readShort(bytes, size, 8);
+    index.frames.resize(std::max<int16_t>(frames, 0));
+    size_t pos = headerSize;
+    for (auto& frame : index.frames) {
+        frame.offset = static_cast<uint32_t>(pos);
+        while (true) {
+            auto op = readLong(bytes, size, pos);
+            pos += 4;
+            if (static_cast<rleop>(op >> 24) != line_start) {
+                break;
+            }
+            auto count = op & 0x00FFFFFF;
+            if (count != 0) {
+                pos += count;
+                if (frame.bottom == 0) {
+                    frame.top = frame.lines;
+                }
+                frame.bottom = frame.lines + 1;
+            }
+            frame.lines++;
+        }
+        if (pos > size) {
+            throw std::out_of_range("Unexpected end of rlëD data");
+        }
+    }
+    return index;
+}
+
+static void writeShort(std::vector<char>& out, uint16_t value) {
+    out.push_back(static_cast<char>(value >> 8));
+    out.push_back(static_cast<char>(value));
+}
+
+static void writeLong(std::vector<char>& out, uint32_t value) {
+    writeShort(out, value >> 16);
+    writeShort(out, value & 0xFFFF);
+}
+
+std::vector<char> rleIndexData(const RleIndex& index) {
+    std::vector<char> out;
+    out.reserve(20 + index.frames.size() * 12);
+    writeShort(out, 1);
+    writeShort(out, static_cast<uint16_t>(index.frames.size()));
+    writeShort(out, index.height);
+    writeShort(out, 0);
+    writeLong(out, index.size);
+    writeLong(out, index.hash >> 32);
+    writeLong(out, index.hash & 0xFFFFFFFF);
+    for (auto& frame : index.frames) {
+        writeLong(out, frame.offset);
+        writeShort(out, frame.lines);
+        writeShort(out, frame.top);
+        writeShort(out, frame.bottom);
+        writeShort(out, 0);
+    }
+    return out;
+}
+
+void writeRleHeader(int16_t width, int16_t height, int16_t frames, std::vector<char>& out) {
+    writeShort(out, width);
+    writeShort(out, height);
+    writeShort(out, 16);
+    writeShort(out, 0);
+    writeShort(out, frames);
+    writeShort(out, 0);
+    writeShort(out, 0);
+    writeShort(out, 0);
+}
+
+void encodeRleFrame(const int32_t* pixels, int width, int height, std::vector<char>& out) {
+    LineEncoder encoder;
+    for (int y=0; y<height; y++) {
+        encoder.encode(pixels + y * width, width);
+        auto& line = encoder.line();
+        writeLong(out, line_start << 24 | static_cast<uint32_t>(line.size()));
+        out.insert(out.end(), line.begin(), line.end());
+    }
+    writeLong(out, eof << 24);
+}
@@ -0,0 +1,88 @@
+//
+//  condense.hpp
+//  rleduce
+//
+
+#ifndef condense_hpp
+#define condense_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "arena.hpp"
+
+enum rleop: uint8_t {
+    eof = 0x00,
+    line_start = 0x01,
+    pixel_data = 0x02,
+    transparent_run = 0x03,
+    pixel_run = 0x04,
+};
+
+typedef struct RleCondensed {
+    int16_t frames = 0;
+    int16_t height = 0;
+    int16_t newHeight = 0;
+    size_t size = 0;
+    // Only populated when the condensed rlëD is smaller than the original
+    std::vector<char> data;
+} RleCondensed;
+
+// Condense an rlëD, working directly on its bytes.
+// Trailing empty lines are dropped from each frame and, if trim is set, blank lines are trimmed from the
+// top and bottom of the whole sprite. The frame data is otherwise unchanged, so the output is assembled
+// from as few contiguous copies of the input as possible.
+// If reencode is set, each line of a 16-bit rlëD is decoded and written again with the shortest possible
+// sequence of ops, wherever that is smaller than the original. The decoded pixels are unchanged.
+RleCondensed condenseRle(const char* bytes, size_t size, bool trim, bool reencode = false);
+
+// Whether a condensed rlëD decodes to the same frames as the original, allowing for lines trimmed from the top
+// and bottom of every frame
+bool sameRleFrames(const char* original, size_t originalSize, const char* condensed, size_t condensedSize);
+
+// The header of a 16-bit rlëD
+void writeRleHeader(int16_t width, int16_t height, int16_t frames, std::vector<char>& out);
+
+// Append one frame of a 16-bit rlëD, using the fewest bytes of ops for each line.
+// Pixels are rgb555 values, or -1 where transparent.
+void encodeRleFrame(const int32_t* pixels, int width, int height, std::vector<char>& out);
+
+// Decode one frame of a 16-bit rlëD starting at pos, leaving pos after its eof op. Values are as for
+// encodeRleFrame(). Returns false if the frame doesn't fit the size or can't be decoded.
+bool decodeRleFrame(const char* bytes, size_t size, size_t& pos, int width, int height, int32_t* values);
+// Decode every frame of a 16-bit rlëD, one after another
+bool decodeRleFrames(const char* bytes, size_t size, ScratchVector<int32_t>& values);
+
+typedef struct RleFrameIndex {
+    // Offset of the frame's first op from the start of the rlëD
+    uint32_t offset = 0;
+    // Number of line_start ops in the frame
+    uint16_t lines = 0;
+    // First line with pixels and one past the last, both 0 if the frame is empty
+    uint16_t top = 0;
+    uint16_t bottom = 0;
+} RleFrameIndex;
+
+// Side index of an rlëD, stored as an rlëI resource with the same ID.
+// All values are big-endian:
+//   0  short   version (1)
+//   2  short   frame count
+//   4  short   frame height
+//   6  short   reserved
+//   8  long    size of the rlëD data
+//  12  8 bytes hash64 of the rlëD data, so a stale index can be detected
+//  20  12 bytes per frame: long offset, short lines, short top, short bottom, short reserved
+typedef struct RleIndex {
+    int16_t height = 0;
+    uint32_t size = 0;
+    uint64_t hash = 0;
+    std::vector<RleFrameIndex> frames;
+} RleIndex;
+
+// Scan an rlëD once to find where each frame starts and which of its lines have content.
+RleIndex indexRle(const char* bytes, size_t size);
+
+// Serialize an index in the rlëI layout.
+std::vector<char> rleIndexData(const RleIndex& index);
+
+#endif /* condense_hpp */
@@ -0,0 +1,64 @@
+//
+//  decodecache.cpp
+//  rleduce
+//
+
+#include "libGraphite/quickdraw/pict.hpp"
+#include "decodecache.hpp"
+using namespace graphite;
+
+DecodeCache::DecodeCache(rsrc::file& file) : file(file) {}
+
+void DecodeCache::expect(int16_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries[id].uses++;
+}
+
+std::shared_ptr<const DecodeCache::Pict> DecodeCache::pict(int16_t id) {
+    std::promise<std::shared_ptr<const Pict>> promise;
+    std::shared_future<std::shared_ptr<const Pict>> existing;
+    std::shared_ptr<rsrc::resource> resource;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& entry = entries[id];
+        if (entry.pict.valid()) {
+            existing = entry.pict;
+            reused++;
+        } else {
+            entry.pict = promise.get_future().share();
+            // Finding is done under the lock, as the file isn't safe to search from several threads at once
+            resource = file.find("PICT", id, {}).lock();
+            decoded++;
+        }
+    }
+    if (existing.valid()) {
+        // Rethrows if the decode failed
+        return existing.get();
+    }
+    if (resource == nullptr) {
+        promise.set_value(nullptr);
+        return nullptr;
+    }
+    try {
+        auto result = std::make_shared<Pict>();
+        auto data = resource->data();
+        auto pict = qd::pict(data);
+        result->surface = pict.image_surface().lock();
+        result->format = pict.format();
+        result->size = data->size();
+        result->name = resource->name();
+        promise.set_value(result);
+        return result;
+    } catch (...) {
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+}
+
+void DecodeCache::release(int16_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto entry = entries.find(id);
+    if (entry != entries.end() && --entry->second.uses <= 0) {
+        entries.erase(entry);
+    }
+}
@@ -0,0 +1,55 @@
+//
+//  decodecache.hpp
+//  rleduce
+//
+
+#ifndef decodecache_hpp
+#define decodecache_hpp
+
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "libGraphite/quickdraw/surface.hpp"
+#include "libGraphite/rsrc/file.hpp"
+
+// Decoded sprite and mask PICTs by ID, shared by all the spïns and shäns in a file that use them.
+// Each PICT is decoded once, by whichever thread asks first; any other thread asking waits for that decode.
+// Uses are counted in advance so each decode can be dropped after its last use.
+class DecodeCache {
+public:
+    typedef struct Pict {
+        // Shared between users, so it must not be modified
+        std::shared_ptr<graphite::qd::surface> surface;
+        int format = 0;
+        size_t size = 0;
+        std::string name;
+    } Pict;
+
+    explicit DecodeCache(graphite::rsrc::file& file);
+
+    // Note an upcoming use of a PICT, so its decode is kept until then
+    void expect(int16_t id);
+    // The decoded PICT, or null if there is none with this ID. Rethrows if the decode failed.
+    std::shared_ptr<const Pict> pict(int16_t id);
+    // Finish a use of a PICT, dropping its decode once no more are expected
+    void release(int16_t id);
+
+    int decodes() const { return decoded; }
+    int reuses() const { return reused; }
+
+private:
+    typedef struct Entry {
+        int uses = 0;
+        std::shared_future<std::shared_ptr<const Pict>> pict;
+    } Entry;
+
+    graphite::rsrc::file& file;
+    std::mutex mutex;
+    std::unordered_map<int16_t, Entry> entries;
+    int decoded = 0;
+    int reused = 0;
+};
+
+#endif /* decodecache_hpp */
@@ -0,0 +1,87 @@
+//
+//  dedup.cpp
+//  rleduce
+//
+
+#include <algorithm>
+#include <chrono>
+#include "dedup.hpp"
+
+bool ResultDedup::acquire(const ResultKey& key, const std::string& location, CacheEntry& entry) {
+    std::shared_future<CacheEntry> result;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto [payload, inserted] = payloads.try_emplace(key);
+        payload->second.locations.push_back(location);
+        if (inserted) {
+            payload->second.result = owners[key].get_future().share();
+            return false;
+        }
+        result = payload->second.result;
+    }
+    if (result.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        return false;
+    }
+    // Rethrows if the owner failed
+    entry = result.get();
+    return true;
+}
+
+void ResultDedup::publish(const ResultKey& key, const CacheEntry& entry) {
+    std::promise<CacheEntry> promise;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto owner = owners.find(key);
+        if (owner == owners.end()) {
+            return;
+        }
+        promise = std::move(owner->second);
+        owners.erase(owner);
+    }
+    promise.set_value(entry);
+}
+
+void ResultDedup::fail(const ResultKey& key, std::exception_ptr error) {
+    std::promise<CacheEntry> promise;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto owner = owners.find(key);
+        if (owner == owners.end()) {
+            return;
+        }
+        promise = std::move(owner->second);
+        owners.erase(owner);
+    }
+    promise.set_exception(error);
+}
+
+void ResultDedup::report(std::ostream& out, bool verbose) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::pair<size_t, const Payload*>> duplicated;
+    size_t copies = 0;
+    size_t cost = 0;
+    for (auto& [key, payload] : payloads) {
+        if (payload.locations.size() > 1) {
+            duplicated.push_back({key.size, &payload});
+            copies += payload.locations.size() - 1;
+            cost += (payload.locations.size() - 1) * key.size;
+        }
+    }
+    out << "Duplicates: " << copies << " resources repeat " << duplicated.size() << " unique payloads, costing " << cost << " bytes." << std::endl;
+    if (!verbose) {
+        return;
+    }
+    // Largest cost first
+    std::sort(duplicated.begin(), duplicated.end(), [](const auto& a, const auto& b) {
+        return (a.second->locations.size() - 1) * a.first > (b.second->locations.size() - 1) * b.first;
+    });
+    for (auto [size, payload] : duplicated) {
+        auto locations = payload->locations;
+        std::sort(locations.begin(), locations.end());
+        out << "  " << size << " bytes x " << locations.size() << ":";
+        for (auto& location : locations) {
+            out << " " << location;
+        }
+        out << std::endl;
+    }
+}
@@ -0,0 +1,48 @@
+//
+//  dedup.hpp
+//  rleduce
+//
+
+#ifndef dedup_hpp
+#define dedup_hpp
+
+#include <future>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "cache.hpp"
+
+// Tracks resource payloads seen during a run so unique payloads are optimized once where possible.
+// The first resource with a given payload becomes its owner and must publish a result (or a failure); any other
+// resource with the same payload receives that result if it's already there. Duplicates never wait for their owner,
+// as both may be running on the same pool thread, and compute the result themselves if it isn't ready.
+class ResultDedup {
+public:
+    // Returns true with the entry filled if the payload's result is already known, or false if the caller must
+    // compute it. Rethrows the owner's failure. A duplicate that computes the result may publish it for the owner.
+    bool acquire(const ResultKey& key, const std::string& location, CacheEntry& entry);
+    void publish(const ResultKey& key, const CacheEntry& entry);
+    void fail(const ResultKey& key, std::exception_ptr error);
+
+    // List duplicated payloads and the bytes they cost
+    void report(std::ostream& out, bool verbose);
+
+private:
+    typedef struct Payload {
+        std::vector<std::string> locations;
+        std::shared_future<CacheEntry> result;
+    } Payload;
+
+    // Keys are only equal if their size and check match too, so colliding payloads are kept apart
+    typedef struct KeyHash {
+        size_t operator()(const ResultKey& key) const { return static_cast<size_t>(key.hash); }
+    } KeyHash;
+
+    std::mutex mutex;
+    std::unordered_map<ResultKey, Payload, KeyHash> payloads;
+    std::unordered_map<ResultKey, std::promise<CacheEntry>, KeyHash> owners;
+};
+
+#endif /* dedup_hpp */
@@ -0,0 +1,218 @@
+//
+//  dither.cpp
+//  rleduce
+//
+
+#include <algorithm>
+#include <vector>
+#include "arena.hpp"
+#include "dither.hpp"
+#include "pool.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define DITHER_SSE2 1
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define DITHER_AVX2 1
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#define DITHER_NEON 1
+#endif
+
+// Add the downward error to each component of a row, clamping to 0-255
+typedef void (*ApplyError)(uint8_t* row, const int16_t* errors, int count);
+
+static void applyErrorScalar(uint8_t* row, const int16_t* errors, int count) {
+    for (int i=0; i<count; i++) {
+        row[i] = std::clamp(row[i] + errors[i], 0, 255);
+    }
+}
+
+#if DITHER_SSE2
+static void applyErrorSSE2(uint8_t* row, const int16_t* errors, int count) {
+    auto zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i+16 <= count; i += 16) {
+        auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+        auto lo = _mm_unpacklo_epi8(bytes, zero);
+        auto hi = _mm_unpackhi_epi8(bytes, zero);
+        lo = _mm_add_epi16(lo, _mm_loadu_si128(reinterpret_cast<const __m128i*>(errors + i)));
+        hi = _mm_add_epi16(hi, _mm_loadu_si128(reinterpret_cast<const __m128i*>(errors + i + 8)));
+        // Saturating pack does the clamp
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(row + i), _mm_packus_epi16(lo, hi));
+    }
+    applyErrorScalar(row + i, errors + i, count - i);
+}
+#endif
+
+#if DITHER_AVX2
+__attribute__((target("avx2")))
+static void applyErrorAVX2(uint8_t* row, const int16_t* errors, int count) {
+    int i = 0;
+    for (; i+32 <= count; i += 32) {
+        auto lo = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i)));
+        auto hi = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i + 16)));
+        lo = _mm256_add_epi16(lo, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(errors + i)));
+        hi = _mm256_add_epi16(hi, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(errors + i + 16)));
+        // Pack works within 128-bit lanes, so restore the order afterwards
+        auto packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(row + i), packed);
+    }
+    applyErrorScalar(row + i, errors + i, count - i);
+}
+#endif
+
+#if DITHER_NEON
+static void applyErrorNEON(uint8_t* row, const int16_t* errors, int count) {
+    int i = 0;
+    for (; i+8 <= count; i += 8) {
+        auto wide = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(row + i)));
+        vst1_u8(row + i, vqmovun_s16(vaddq_s16(wide, vld1q_s16(errors + i))));
+    }
+    applyErrorScalar(row + i, errors + i, count - i);
+}
+#endif
+
+static ApplyError selectApplyError() {
+#if DITHER_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        return applyErrorAVX2;
+    }
+#endif
+#if DITHER_SSE2
+    return applyErrorSSE2;
+#elif DITHER_NEON
+    return applyErrorNEON;
+#else
+    return applyErrorScalar;
+#endif
+}
+
+// Narrowest part of a row dithered as its own task
+static const int segmentWidth = 512;
+
+// Reduce a component with the error carried into it, storing the error for the pixel below. Returns the error.
+static inline int ditherComponent(int value, int carry, const uint8_t* table, uint8_t& pixel, int16_t& down) {
+    value = std::clamp(value + carry, 0, 255);
+    int error = value - table[value];
+    pixel = table[value];
+    down = (error + 1) / 2;
+    return error;
+}
+
+// Dither a pixel from its value before dithering, adding the error carried from the previous pixel along its row
+// and updating the carry for the next. This is the same arithmetic as ditherRgb555, with the error to the side
+// held rather than added to the neighbour.
+static inline void ditherPixel(const uint8_t* source, uint8_t* pixel, int16_t* down, int8_t* carry,
+                               const DitherTables& tables) {
+    int red = ditherComponent(source[0], carry[0], tables.red, pixel[0], down[0]);
+    int green = ditherComponent(source[1], carry[1], tables.green, pixel[1], down[1]);
+    int blue = ditherComponent(source[2], carry[2], tables.blue, pixel[2], down[2]);
+    carry[0] = red / 2;
+    carry[1] = green / 2;
+    carry[2] = blue / 2;
+    pixel[3] = red || green || blue ? tables.alpha[source[3]] : source[3];
+    down[3] = 0;
+}
+
+// Dither rows split into segments across the pool. Rows still go one at a time, as alternating scan directions
+// mean each row needs all of the row above. Within a row, each segment is dithered at once assuming nothing is
+// carried into it. The carry is then passed along the segments in order, redoing each from its start until the
+// carry matches what the assumption gave, after which the rest of the segment is already right. Carries of
+// an error of -1 to 1 are 0, so they usually match within a few pixels, and the result is identical to
+// dithering the row serially.
+static void ditherSegments(uint8_t* pixels, int width, int height, const DitherTables& tables, WorkPool& pool,
+                           ApplyError applyError) {
+    auto segments = std::min(pool.jobs(), width / segmentWidth);
+    ScratchVector<uint8_t> source(width * 4);
+    ScratchVector<int16_t> down(width * 4);
+    // The carry after each pixel, as dithered assuming no carry into its segment
+    ScratchVector<int8_t> carries(width * 3);
+    for (int y=0; y<height; y++) {
+        bool even = y % 2 == 0;
+        auto row = pixels + y * width * 4;
+        std::copy(row, row + width * 4, source.begin());
+        auto pixelAt = [&](int position) {
+            return even ? position : width - position - 1;
+        };
+        auto ditherAt = [&](int position, int8_t* carry) {
+            auto x = pixelAt(position);
+            ditherPixel(source.data() + x * 4, row + x * 4, down.data() + x * 4, carry, tables);
+        };
+        pool.parallelFor(segments, [&](size_t i) {
+            int8_t carry[3] = { 0, 0, 0 };
+            auto start = static_cast<int>(i * width / segments);
+            auto end = static_cast<int>((i + 1) * width / segments);
+            for (auto position = start; position < end; position++) {
+                ditherAt(position, carry);
+                std::copy(carry, carry + 3, carries.begin() + pixelAt(position) * 3);
+            }
+        });
+        int8_t carry[3] = { 0, 0, 0 };
+        for (int i=0; i<segments; i++) {
+            auto start = static_cast<int>(i * width / segments);
+            auto end = static_cast<int>((i + 1) * width / segments);
+            bool matched = !(carry[0] || carry[1] || carry[2]);
+            for (auto position = start; position < end && !matched; position++) {
+                ditherAt(position, carry);
+                matched = std::equal(carry, carry + 3, carries.data() + pixelAt(position) * 3);
+            }
+            if (matched) {
+                std::copy_n(carries.data() + pixelAt(end - 1) * 3, 3, carry);
+            }
+        }
+        if (y+1 < height) {
+            applyError(row + width * 4, down.data(), width * 4);
+        }
+    }
+}
+
+void ditherRgb555(uint8_t* pixels, int width, int height, const DitherTables& tables, WorkPool* pool) {
+    static const ApplyError applyError = selectApplyError();
+    if (pool && pool->jobs() > 1 && width >= segmentWidth * 2) {
+        ditherSegments(pixels, width, height, tables, *pool, applyError);
+        return;
+    }
+    // Error to be diffused down from the current row, already halved
+    ScratchVector<int16_t> down(width * 4);
+    for (int y=0; y<height; y++) {
+        bool even = y % 2 == 0;
+        auto row = pixels + y * width * 4;
+        bool diffused = false;
+        for (int w=0; w<width; w++) {
+            int x = even ? w : width - w - 1;
+            auto pixel = row + x * 4;
+            auto error = down.data() + x * 4;
+            int red = tables.red[pixel[0]];
+            int green = tables.green[pixel[1]];
+            int blue = tables.blue[pixel[2]];
+            int errors[3] = { pixel[0] - red, pixel[1] - green, pixel[2] - blue };
+            if (errors[0] || errors[1] || errors[2]) {
+                pixel[0] = red;
+                pixel[1] = green;
+                pixel[2] = blue;
+                pixel[3] = tables.alpha[pixel[3]];
+                int next = even ? x+1 : x-1;
+                if (next >= 0 && next < width) {
+                    auto neighbour = row + next * 4;
+                    for (int i=0; i<3; i++) {
+                        neighbour[i] = std::clamp(neighbour[i] + (errors[i] / 2), 0, 255);
+                    }
+                }
+                for (int i=0; i<3; i++) {
+                    error[i] = (errors[i] + 1) / 2;
+                }
+                error[3] = 0;
+                diffused = true;
+            } else {
+                std::fill(error, error + 4, 0);
+            }
+        }
+        if (diffused && y+1 < height) {
+            applyError(row + width * 4, down.data(), width * 4);
+        }
+    }
+}
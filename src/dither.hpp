@@ -0,0 +1,30 @@
+//
+//  dither.hpp
+//  rleduce
+//
+
+#ifndef dither_hpp
+#define dither_hpp
+
+#include <cstdint>
+
+class WorkPool;
+
+// Lookup tables describing how a colour component is reduced to 5 bits and expanded back again.
+// These are filled from the colour conversion in use so the dither reproduces it exactly.
+typedef struct DitherTables {
+    uint8_t red[256];
+    uint8_t green[256];
+    uint8_t blue[256];
+    // Alpha of a reduced colour, by original alpha
+    uint8_t alpha[256];
+} DitherTables;
+
+// QuickDraw dithering algorithm, applied in place to rows of RGBA pixels.
+// Half the error is diffused right on even rows, left on odd rows. The remainder is diffused down.
+// The serpentine diffusion along each row is inherently serial; the downward diffusion into the next
+// row is applied a whole row at a time using SSE2/AVX2 or NEON where available.
+// Given a pool, each row of a wide image is split across threads, with identical results.
+void ditherRgb555(uint8_t* pixels, int width, int height, const DitherTables& tables, WorkPool* pool = nullptr);
+
+#endif /* dither_hpp */
@@ -0,0 +1,267 @@
+//
+//  estimate.cpp
+//  rleduce
+//
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <set>
+#include "api.hpp"
+#include "arena.hpp"
+#include "estimate.hpp"
+#include "hash.hpp"
+using namespace graphite;
+
+// Fewest resources of a kind sampled, so there's some spread to bound the projection with
+static const size_t minimumSamples = 5;
+// Normal quantile of a 95% confidence interval
+static const double confidenceZ = 1.96;
+
+double Projection::low() const {
+    return value - confidenceZ * std::sqrt(variance);
+}
+
+double Projection::high() const {
+    return value + confidenceZ * std::sqrt(variance);
+}
+
+Projection& Projection::operator+=(const Projection& other) {
+    value += other.value;
+    variance += other.variance;
+    return *this;
+}
+
+// A resource that would be processed. Sprite layers also have the mask PICT they're encoded from.
+typedef struct Item {
+    std::shared_ptr<rsrc::resource> resource;
+    std::shared_ptr<rsrc::resource> mask;
+    SpriteLayer layer;
+    int64_t size = 0;
+} Item;
+
+typedef struct Sample {
+    double size = 0;
+    double saved = 0;
+    double seconds = 0;
+} Sample;
+
+// Project a sample's total onto the whole population as a ratio of bytes, so resources that save or take more
+// in proportion to their size don't widen the interval. Every resource counts the same if there are no bytes.
+static Projection project(const std::vector<Sample>& samples, int count, int64_t bytes, double Sample::*member) {
+    Projection projection;
+    size_t n = samples.size();
+    if (n == 0) {
+        return projection;
+    }
+    double sampleBytes = 0;
+    double sampleTotal = 0;
+    for (auto& sample : samples) {
+        sampleBytes += sample.size;
+        sampleTotal += sample.*member;
+    }
+    bool bySize = sampleBytes > 0;
+    double ratio = sampleTotal / (bySize ? sampleBytes : n);
+    projection.value = ratio * (bySize ? bytes : count);
+    if (n < static_cast<size_t>(count)) {
+        double residuals = 0;
+        for (auto& sample : samples) {
+            auto residual = sample.*member - ratio * (bySize ? sample.size : 1);
+            residuals += residual * residual;
+        }
+        auto spread = residuals / (n - 1);
+        projection.variance = static_cast<double>(count) * count * (1 - static_cast<double>(n) / count) * spread / n;
+    }
+    return projection;
+}
+
+// Pick a fraction of the items, in an order set by their type and ID so repeated estimates pick the same ones
+static std::vector<size_t> sampleItems(const std::string& type, const std::vector<Item>& items, double fraction) {
+    auto typeHash = hash64(type.data(), type.size());
+    std::vector<std::pair<uint64_t, size_t>> order;
+    for (size_t i=0; i<items.size(); i++) {
+        order.push_back({hashCombine(typeHash, items[i].resource->id()), i});
+    }
+    std::sort(order.begin(), order.end());
+    auto count = std::max(std::min(items.size(), minimumSamples), static_cast<size_t>(std::ceil(items.size() * fraction)));
+    count = std::min(count, items.size());
+    std::vector<size_t> indices;
+    for (size_t i=0; i<count; i++) {
+        indices.push_back(order[i].second);
+    }
+    std::sort(indices.begin(), indices.end());
+    return indices;
+}
+
+// Process a sample of the items, each returning the bytes it saves, and project the savings and time
+static TypeEstimate estimateType(const std::string& type, const std::vector<Item>& items, double fraction,
+                                 const std::function<int64_t(const Item&)>& process, double& elapsed) {
+    TypeEstimate estimate;
+    estimate.type = type;
+    estimate.count = static_cast<int>(items.size());
+    for (auto& item : items) {
+        estimate.bytes += item.size;
+    }
+    std::vector<Sample> samples;
+    for (auto i : sampleItems(type, items, fraction)) {
+        ArenaScope scope;
+        Sample sample;
+        sample.size = items[i].size;
+        auto start = std::chrono::steady_clock::now();
+        try {
+            sample.saved = process(items[i]);
+        } catch (const std::exception& e) {
+            // A failed resource is left as it is, saving nothing
+            estimate.failed++;
+        }
+        sample.seconds = elapsedNanoseconds(start) / 1e9;
+        elapsed += sample.seconds;
+        samples.push_back(sample);
+    }
+    estimate.sampled = static_cast<int>(samples.size());
+    estimate.saved = project(samples, estimate.count, estimate.bytes, &Sample::saved);
+    estimate.seconds = project(samples, estimate.count, estimate.bytes, &Sample::seconds);
+    return estimate;
+}
+
+static std::vector<Item> resourceItems(rsrc::file& file, const std::string& type, const std::set<int64_t>& excluded) {
+    std::vector<Item> items;
+    for (auto resource : file.type_container(type).lock()->resources()) {
+        if (!excluded.count(resource->id())) {
+            Item item;
+            item.resource = resource;
+            item.size = resource->data()->size();
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+// The sprite layers that would be converted, each once as when processing. When encoding, the IDs of the PICTs
+// they're encoded from are added to the set, as those PICTs would be replaced.
+static std::vector<Item> spriteItems(rsrc::file& file, bool encode, std::set<int64_t>& picts) {
+    std::vector<Item> items;
+    std::set<int16_t> converted;
+    for (auto typeCode : {"spïn", "shän"}) {
+        for (auto resource : file.type_container(typeCode).lock()->resources()) {
+            std::vector<SpriteLayer> layers;
+            try {
+                layers = spriteLayers(typeCode, resource->data());
+            } catch (const std::exception& e) {
+                continue;
+            }
+            for (auto& layer : layers) {
+                if (layer.spriteID <= 0 || layer.maskID <= 0 || converted.count(layer.spriteID)) {
+                    continue;
+                }
+                Item item;
+                item.layer = layer;
+                if (encode) {
+                    item.resource = file.find("PICT", layer.spriteID, {}).lock();
+                    item.mask = file.find("PICT", layer.maskID, {}).lock();
+                    if (item.resource == nullptr || item.mask == nullptr) {
+                        continue;
+                    }
+                    item.size = item.resource->data()->size() + item.mask->data()->size();
+                    picts.insert(layer.spriteID);
+                    picts.insert(layer.maskID);
+                } else {
+                    item.resource = file.find("rlëD", layer.spriteID, {}).lock();
+                    if (item.resource == nullptr) {
+                        continue;
+                    }
+                    item.size = item.resource->data()->size();
+                }
+                converted.insert(layer.spriteID);
+                items.push_back(item);
+            }
+        }
+    }
+    return items;
+}
+
+static int64_t processSprite(const Engine& engine, const Item& item) {
+    auto data = item.resource->data();
+    if (engine.options.encode) {
+        auto mask = item.mask->data();
+        auto rle = encodeSprite(engine, item.layer, dataBytes(data), data->size(), dataBytes(mask), mask->size());
+        return item.size - static_cast<int64_t>(rle.size());
+    }
+    std::vector<char> sprite;
+    std::vector<char> mask;
+    decodeSprite(engine, item.layer, dataBytes(data), data->size(), sprite, mask);
+    return item.size - static_cast<int64_t>(sprite.size() + mask.size());
+}
+
+static int64_t processResource(const Engine& engine, const Item& item,
+                               int64_t (*process)(const Engine&, ResourcePayload&, Result&)) {
+    auto payload = resourcePayload(item.resource);
+    Result result;
+    return process(engine, payload, result);
+}
+
+FileEstimate estimateFile(const Engine& engine, rsrc::file& file, double fraction) {
+    auto& options = engine.options;
+    FileEstimate estimate;
+    std::set<int64_t> spritePicts;
+    if (options.encode || options.decode) {
+        auto items = spriteItems(file, options.encode, spritePicts);
+        estimate.types.push_back(estimateType("sprite", items, fraction, [&](const Item& item) {
+            return processSprite(engine, item);
+        }, estimate.seconds));
+    }
+    if (options.condense) {
+        auto items = resourceItems(file, "rlëD", {});
+        estimate.types.push_back(estimateType("rlëD", items, fraction, [&](const Item& item) {
+            return processResource(engine, item, processRle);
+        }, estimate.seconds));
+    }
+    if (options.picts) {
+        auto items = resourceItems(file, "PICT", spritePicts);
+        estimate.types.push_back(estimateType("PICT", items, fraction, [&](const Item& item) {
+            return processResource(engine, item, processPict);
+        }, estimate.seconds));
+    }
+    return estimate;
+}
+
+void addEstimates(std::vector<TypeEstimate>& totals, const std::vector<TypeEstimate>& types) {
+    for (auto& estimate : types) {
+        auto total = std::find_if(totals.begin(), totals.end(), [&](const TypeEstimate& total) {
+            return total.type == estimate.type;
+        });
+        if (total == totals.end()) {
+            totals.push_back(estimate);
+            continue;
+        }
+        total->count += estimate.count;
+        total->bytes += estimate.bytes;
+        total->sampled += estimate.sampled;
+        total->failed += estimate.failed;
+        total->saved += estimate.saved;
+        total->seconds += estimate.seconds;
+    }
+}
+
+static std::string estimateRow(const std::string& label, const std::string& sampled, const Projection& saved,
+                               const Projection& seconds) {
+    return stringf("%-7s %15s  %10.0f (%.0f to %.0f)  %8.2fs (%.2fs to %.2fs)\n", label.c_str(), sampled.c_str(),
+                   saved.value, saved.low(), saved.high(), seconds.value, std::max(0.0, seconds.low()), seconds.high());
+}
+
+double printEstimates(std::ostream& out, const std::vector<TypeEstimate>& types) {
+    out << "Type            Sampled  Bytes saved (95% range)  Time (95% range)\n";
+    Projection saved;
+    Projection seconds;
+    for (auto& estimate : types) {
+        auto sampled = stringf("%d of %d", estimate.sampled, estimate.count);
+        out << estimateRow(estimate.type, sampled, estimate.saved, estimate.seconds);
+        if (estimate.failed) {
+            out << "        " << estimate.failed << " sampled " << estimate.type << "s failed and would be left unchanged.\n";
+        }
+        saved += estimate.saved;
+        seconds += estimate.seconds;
+    }
+    out << estimateRow("Total", "", saved, seconds);
+    return seconds.value;
+}
@@ -0,0 +1,56 @@
+//
+//  estimate.hpp
+//  rleduce
+//
+
+#ifndef estimate_hpp
+#define estimate_hpp
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include "libGraphite/rsrc/file.hpp"
+#include "rleduce.hpp"
+
+// A total projected from a sample, with the variance of the projection
+typedef struct Projection {
+    double value = 0;
+    double variance = 0;
+
+    // Bounds of the 95% confidence interval
+    double low() const;
+    double high() const;
+
+    Projection& operator+=(const Projection& other);
+} Projection;
+
+// What processing one kind of resource would save and take
+typedef struct TypeEstimate {
+    // rlëD, PICT or sprite
+    std::string type;
+    // Resources of this kind and their total size
+    int count = 0;
+    int64_t bytes = 0;
+    // Resources actually processed, and how many of those failed
+    int sampled = 0;
+    int failed = 0;
+    Projection saved;
+    Projection seconds;
+} TypeEstimate;
+
+typedef struct FileEstimate {
+    std::vector<TypeEstimate> types;
+    // Time spent processing the sample
+    double seconds = 0;
+} FileEstimate;
+
+// Estimate what the engine's options would save in a file and how long processing would take, by processing a
+// sample of at least the given fraction of each kind of resource. The file isn't changed.
+FileEstimate estimateFile(const Engine& engine, graphite::rsrc::file& file, double fraction);
+
+// Add estimates to running totals, by type
+void addEstimates(std::vector<TypeEstimate>& totals, const std::vector<TypeEstimate>& types);
+// Print a line per type and a total. Returns the projected processing time.
+double printEstimates(std::ostream& out, const std::vector<TypeEstimate>& types);
+
+#endif /* estimate_hpp */
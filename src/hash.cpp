@@ -0,0 +1,46 @@
+//
+//  hash.cpp
+//  rleduce
+//
+
+#include <cstring>
+#include "hash.hpp"
+
+static const uint64_t multiplier = 0xc6a4a7935bd1e995ULL;
+static const int shift = 47;
+
+uint64_t hash64(const void* bytes, size_t size, uint64_t seed) {
+    auto data = static_cast<const uint8_t*>(bytes);
+    uint64_t hash = seed ^ (size * multiplier);
+
+    auto end = data + (size / 8) * 8;
+    for (; data != end; data += 8) {
+        uint64_t k;
+        memcpy(&k, data, 8);
+        k *= multiplier;
+        k ^= k >> shift;
+        k *= multiplier;
+        hash ^= k;
+        hash *= multiplier;
+    }
+
+    switch (size & 7) {
+        case 7: hash ^= uint64_t(data[6]) << 48; [[fallthrough]];
+        case 6: hash ^= uint64_t(data[5]) << 40; [[fallthrough]];
+        case 5: hash ^= uint64_t(data[4]) << 32; [[fallthrough]];
+        case 4: hash ^= uint64_t(data[3]) << 24; [[fallthrough]];
+        case 3: hash ^= uint64_t(data[2]) << 16; [[fallthrough]];
+        case 2: hash ^= uint64_t(data[1]) << 8; [[fallthrough]];
+        case 1: hash ^= uint64_t(data[0]);
+            hash *= multiplier;
+    }
+
+    hash ^= hash >> shift;
+    hash *= multiplier;
+    hash ^= hash >> shift;
+    return hash;
+}
+
+uint64_t hashCombine(uint64_t hash, uint64_t value) {
+    return hash64(&value, sizeof(value), hash);
+}
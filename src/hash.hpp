@@ -0,0 +1,18 @@
+//
+//  hash.hpp
+//  rleduce
+//
+
+#ifndef hash_hpp
+#define hash_hpp
+
+#include <cstddef>
+#include <cstdint>
+
+// Fast non-cryptographic 64-bit hash (MurmurHash64A), used to identify resource payloads.
+uint64_t hash64(const void* bytes, size_t size, uint64_t seed = 0);
+
+// Fold a value into an existing hash.
+uint64_t hashCombine(uint64_t hash, uint64_t value);
+
+#endif /* hash_hpp */
@@ -6,555 +6,514 @@
 //
 
 #include <algorithm>
+#include <atomic>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
-#include "libGraphite/data/reader.hpp"
-#include "libGraphite/data/writer.hpp"
-#include "libGraphite/quickdraw/pict.hpp"
-#include "libGraphite/quickdraw/rle.hpp"
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
 #include "libGraphite/rsrc/file.hpp"
+#include "arena.hpp"
+#include "estimate.hpp"
+#include "pipeline.hpp"
+#include "resfork.hpp"
+#include "rleduce.hpp"
+#include "watch.hpp"
 using namespace graphite;
 
-static struct options {
-    bool condense = false;
-    bool trim = false;
-    bool picts = false;
-    bool reduce = false;
-    bool encode = false;
-    bool decode = false;
-    bool dither = true;
-    bool verbose = false;
-    bool forceFormat = false;
-    rsrc::file::format format;
-} options;
-
-enum rleop: uint8_t {
-    eof = 0x00,
-    line_start = 0x01,
-    pixel_data = 0x02,
-    transparent_run = 0x03,
-    pixel_run = 0x04,
-};
-
-typedef struct Spin {
-    int16_t spriteID;
-    int16_t maskID;
-    qd::size frame;
-    qd::size grid;
-
-    Spin(std::shared_ptr<rsrc::resource> resource) {
-        auto reader = data::reader(resource->data());
-        spriteID = reader.read_short();
-        maskID = reader.read_short();
-        frame = qd::size::read(reader, qd::size::pict);
-        grid = qd::size::read(reader, qd::size::pict);
-    }
-} Spin;
-
-typedef struct Shan {
-    int16_t baseSpriteID;
-    int16_t baseMaskID;
-    int16_t baseSetCount;
-    qd::size baseFrame;
-    int16_t altSpriteID;
-    int16_t altMaskID;
-    int16_t altSetCount;
-    qd::size altFrame;
-    int16_t engineSpriteID;
-    int16_t engineMaskID;
-    qd::size engineFrame;
-    int16_t lightSpriteID;
-    int16_t lightMaskID;
-    qd::size lightFrame;
-    int16_t weaponSpriteID;
-    int16_t weaponMaskID;
-    qd::size weaponFrame;
-    int16_t framesPer;
-    int16_t shieldSpriteID;
-    int16_t shieldMaskID;
-    qd::size shieldFrame;
-
-    Shan(std::shared_ptr<rsrc::resource> resource) {
-        auto reader = data::reader(resource->data());
-        baseSpriteID = reader.read_short();
-        baseMaskID = reader.read_short();
-        baseSetCount = reader.read_short();
-        baseFrame = qd::size::read(reader, qd::size::pict);
-        reader.move(2);
-
-        altSpriteID = reader.read_short();
-        altMaskID = reader.read_short();
-        altSetCount = reader.read_short();
-        altFrame = qd::size::read(reader, qd::size::pict);
-
-        engineSpriteID = reader.read_short();
-        engineMaskID = reader.read_short();
-        engineFrame = qd::size::read(reader, qd::size::pict);
-
-        lightSpriteID = reader.read_short();
-        lightMaskID = reader.read_short();
-        lightFrame = qd::size::read(reader, qd::size::pict);
-
-        weaponSpriteID = reader.read_short();
-        weaponMaskID = reader.read_short();
-        weaponFrame = qd::size::read(reader, qd::size::pict);
-
-        reader.move(6);
-        framesPer = reader.read_short();
-        reader.move(10);
-
-        shieldSpriteID = reader.read_short();
-        shieldMaskID = reader.read_short();
-        shieldFrame = qd::size::read(reader, qd::size::pict);
+// Resolve the output path and format for a processed file
+rsrc::file::format outputFormat(const Options& options, rsrc::file& file, std::filesystem::path path, std::filesystem::path& outpath) {
+    auto format = options.forceFormat ? options.format : file.current_format();
+    if (outpath.empty()) {
+        outpath = path;
+    } else if (!options.forceFormat) {
+        // Determine format from extension
+        auto ext = outpath.extension();
+        if (ext == ".rez") {
+            format = rsrc::file::format::rez;
+        } else if (ext == ".ndat" || ext == ".npif" || ext == ".rsrc") {
+            format = rsrc::file::format::classic;
+        }
     }
-} Shan;
+    return format;
+}
 
-int64_t processRle(std::shared_ptr<rsrc::resource> resource) {
-    auto reader = data::reader(resource->data());
-    auto width = reader.read_short();
-    auto height = reader.read_short();
-    reader.move(4);
-    auto frames = reader.read_short();
-    reader.move(6);
-    
-    rleop opcode;
-    int32_t op;
-    int32_t count;
-    int trim = 0;
-    // Figure out how many lines can be trimmed from top/bottom of the whole sprite
-    if (options.trim) {
-        trim = height/2;
-        for (int i=0; i<frames; i++) {
-            int line = 0;
-            int top = height;
-            int bottom = 0;
-            while (true) {
-                op = reader.read_long();
-                opcode = static_cast<rleop>(op >> 24);
-                if (opcode == line_start) {
-                    count = op & 0x00FFFFFF;
-                    if (count != 0) {
-                        reader.move(count);
-                        if (top > line) {
-                            top = line;
-                        }
-                        bottom = line+1;
-                    }
-                    line++;
-                } else {
-                    break;
-                }
-            }
-            if (top < trim) {
-                trim = top;
-            }
-            bottom = height-bottom;
-            if (bottom < trim) {
-                trim = bottom;
-            }
+// Process a file, writing it if anything changed. Returns whether it was written, and throws if writing failed.
+bool processFile(Engine& engine, std::filesystem::path path, std::filesystem::path outpath, std::ostream& out, std::ostream& err) {
+    auto& stats = engine.stats;
+    auto filename = path.filename();
+    auto fileStats = stats ? stats->addFile(filename.generic_string()) : nullptr;
+    auto finishStats = [&] {
+        if (fileStats) {
+            stats->finishFile(fileStats);
         }
+    };
+    rsrc::file file;
+    try {
+        PhaseTimer timer(parsePhase, fileStats);
+        file = rsrc::file(path.generic_string());
+    } catch (const std::exception& e) {
+        err << filename << ": " << e.what() << std::endl;
+        finishStats();
+        return false;
     }
     
-    auto writer = data::writer();
-    writer.write_short(width);
-    auto newHeight = height - (trim * 2);
-    writer.write_short(newHeight);
-    reader.set_position(4);
-    writer.write_data(reader.read_data(12));
-    for (int i=0; i<frames; i++) {
-        int skip = trim;
-        int blank = 0;
-        while (true) {
-            op = reader.read_long();
-            opcode = static_cast<rleop>(op >> 24);
-            if (opcode == line_start) {
-                if (skip-- > 0) {
-                    continue;
-                }
-                count = op & 0x00FFFFFF;
-                if (count != 0) {
-                    for (int j=0; j<blank; j++) {
-                        writer.write_long(rleop::line_start << 24);
-                    }
-                    writer.write_long(op);
-                    writer.write_data(reader.read_data(count));
-                    blank = 0;
-                } else {
-                    blank++;
-                }
-            } else {
-                writer.write_long(0);
-                break;
-            }
-        }
+    out << "Processing " << filename << "..." << std::endl;
+    FileContext context(engine, filename.generic_string(), fileStats, &out, &err);
+    // Don't rewrite file if nothing changed and outpath not provided
+    bool writeFile = !outpath.empty();
+    writeFile |= transformFile(file, context);
+    if (!writeFile) {
+        out << "No changes written." << std::endl;
+        finishStats();
+        return false;
     }
     
-    auto size = resource->data()->size();
-    auto data = writer.data();
-    auto diff = size - data->size();
-    if (options.verbose) {
-        double pc = diff * 100.0 / size;
-        std::string result = diff > 0 ? "Written" : "Not written";
-        printf("%7lld  %6d  %6d  %8ld  %10d  %8ld  %5.1f%%  %s\n",
-               resource->id(), frames, height, size, newHeight, data->size(), pc, result.c_str());
-    }
-    if (diff > 0) {
-        resource->set_data(data);
-        return diff;
-    }
-    return 0;
-}
-
-void applyError(std::shared_ptr<qd::surface> surface, int x, int y, int errors[3], bool up) {
-    auto color = surface->at(x, y);
-    int add = up ? 1 : 0;
-    int comps[3] = { color.red_component(), color.green_component(), color.blue_component() };
-    for (int i=0; i<3; i++) {
-        comps[i] = std::clamp(comps[i] + ((errors[i] + add) / 2), 0, 255);
-    }
-    surface->set(x, y, qd::color(comps[0], comps[1], comps[2], color.alpha_component()));
-}
-
-void rgb555dither(std::shared_ptr<qd::surface> surface) {
-    // QuickDraw dithering algorithm.
-    // Half the error is diffused right on even rows, left on odd rows. The remainder is diffused down.
-    auto frameWidth = surface->size().width();
-    auto frameHeight = surface->size().height();
-    for (int y=0; y<frameHeight; y++) {
-        bool even = y % 2 == 0;
-        for (int w=0; w<frameWidth; w++) {
-            int x = even ? w : frameWidth - w - 1;
-            auto color = surface->at(x, y);
-            auto newColor = qd::color(color.rgb555());
-            int errors[3] = {
-                color.red_component() - newColor.red_component(),
-                color.green_component() - newColor.green_component(),
-                color.blue_component() - newColor.blue_component()
-            };
-            if (errors[0] || errors[1] || errors[2]) {
-                surface->set(x, y, newColor);
-                if (even && x+1 < frameWidth) {
-                    applyError(surface, x+1, y, errors, false);
-                } else if (!even && x > 0) {
-                    applyError(surface, x-1, y, errors, false);
-                }
-                if (y+1 < frameHeight) {
-                    applyError(surface, x, y+1, errors, true);
-                }
-            }
-        }
+    auto format = outputFormat(engine.options, file, path, outpath);
+    try {
+        PhaseTimer timer(writePhase, fileStats);
+        file.write(outpath.generic_string(), format);
+    } catch (const std::exception&) {
+        finishStats();
+        throw;
     }
+    finishStats();
+    return true;
 }
 
-std::string fourCC(uint32_t code) {
-    std::string str;
-    str.push_back(code >> 24);
-    str.push_back(code >> 16);
-    str.push_back(code >> 8);
-    str.push_back(code);
-    return str;
-}
-
-int64_t processPict(std::shared_ptr<rsrc::resource> resource) {
-    qd::pict pict(resource->data());
-    auto format = pict.format();
-    // Don't dither low depth images
-    if (options.reduce && options.dither && format > 4 && format != 16) {
-        rgb555dither(pict.image_surface().lock());
-    }
-    auto size = resource->data()->size();
-    auto maxDepth = options.reduce || format == 16 ? 16 : 24;
-    auto data = pict.data(maxDepth);
-    int64_t diff = size - data->size();
-    // Force write if format is non-standard (QuickTime) or reduction occurred
-    bool save = diff > 0 || format > 32 || (options.reduce && format != 16);
-    if (options.verbose) {
-        std::string inFormat = format > 32 ? fourCC(format) : std::to_string(format)+"-bit";
-        std::string outFormat = pict.format() > 32 ? fourCC(pict.format()) : std::to_string(pict.format())+"-bit";
-        double pc = diff * 100.0 / size;
-        std::string result = save ? (diff > 0 ? "Written" : "Written (forced)") : "Not written";
-        printf("%7lld  %-6s  %8ld  %-8s  %8ld  %5.1f%%  %s\n",
-               resource->id(), inFormat.c_str(), size, outFormat.c_str(), data->size(), pc, result.c_str());
-    }
-    if (save) {
-        resource->set_data(data);
-        return diff;
-    }
-    return 0;
-}
-
-bool enRle(std::shared_ptr<rsrc::resource> resource, rsrc::file& file, int16_t spriteID, int16_t maskID, qd::size frame) {
-    if (spriteID <= 0 || maskID <= 0) {
+// Whether the selected processing can work on a mapped resource fork. Only rlëDs and PICTs may be changed, in
+// place, and the output must stay in the classic format.
+bool canMap(const Options& options, std::filesystem::path outpath) {
+    if (!(options.mmap || options.incremental) || options.encode || options.decode || options.index) {
         return false;
     }
-    auto spriteRes = file.find("PICT", spriteID, {}).lock();
-    auto maskRes = file.find("PICT", maskID, {}).lock();
-    if (spriteRes == nullptr || maskRes == nullptr) {
-        return false;
+    if (options.forceFormat) {
+        return options.format == rsrc::file::classic;
     }
+    return outpath.extension() != ".rez";
+}
 
-    if (frame.width() <= 0 || frame.height() <= 0) {
-        std::cerr << "Invalid frame size in " << resource->type_code() << " " << resource->id() << "." << std::endl;
-        return false;
-    }
+// Portion of a file that may be left unused by incremental updates before it's compacted
+static const double compactThreshold = 0.25;
 
-    auto spritePict = qd::pict(spriteRes->data());
-    auto sprite = spritePict.image_surface().lock();
-    auto spriteX = sprite->size().width();
-    auto spriteY = sprite->size().height();
-    if (spriteX % frame.width() != 0 || spriteY % frame.height() != 0) {
-        std::cerr << "Sprite PICT " << spriteID << " for " << resource->type_code() << " " << resource->id() << " does not match frame size." << std::endl;
-        return false;
+// Process a file through a memory mapping. Only the selected types are read, and everything else is written
+// back out straight from the mapping. Falls back to processFile() if it isn't a classic resource fork, or if it has
+// rlëIs that condensing could leave out of date. Returns and throws as processFile().
+bool processMappedFile(Engine& engine, std::filesystem::path path, std::filesystem::path outpath, std::ostream& out, std::ostream& err) {
+    auto& options = engine.options;
+    auto& stats = engine.stats;
+    auto filename = path.filename();
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<MappedFork> fork;
+    try {
+        fork = std::make_unique<MappedFork>(path.generic_string());
+    } catch (const std::exception&) {
+        return processFile(engine, path, outpath, out, err);
     }
-    auto maskPict = qd::pict(maskRes->data());
-    auto mask = maskPict.image_surface().lock();
-    if (!(mask->size() == sprite->size())) {
-        std::cerr << "Mask PICT " << maskID << " for " << resource->type_code() << " " << resource->id() << " does not match sprite size." << std::endl;
-        return false;
+    // rlëIs of condensed rlëDs would go out of date, and only processFile() removes them
+    if (options.condense) {
+        auto& entries = fork->entries();
+        bool indexed = std::any_of(entries.begin(), entries.end(), [](const MappedFork::Entry& entry) {
+            return entry.type == rleIndexTypeCode;
+        });
+        if (indexed) {
+            fork.reset();
+            return processFile(engine, path, outpath, out, err);
+        }
     }
-
-    if (options.dither && spritePict.format() != 16) {
-        rgb555dither(sprite);
+    auto fileStats = stats ? stats->addFile(filename.generic_string()) : nullptr;
+    auto finishStats = [&] {
+        if (fileStats) {
+            stats->finishFile(fileStats);
+        }
+    };
+    if (fileStats) {
+        fileStats->phases[parsePhase] += elapsedNanoseconds(start);
+    }
+
+    out << "Processing " << filename << "..." << std::endl;
+    FileContext context(engine, filename.generic_string(), fileStats, &out, &err);
+    auto& entries = fork->entries();
+    std::vector<std::pair<const char*, size_t>> output;
+    std::vector<ResourcePayload> rles;
+    std::vector<ResourcePayload> picts;
+    std::vector<size_t> rleEntries;
+    std::vector<size_t> pictEntries;
+    for (size_t i=0; i<entries.size(); i++) {
+        auto& entry = entries[i];
+        output.emplace_back(entry.bytes, entry.size);
+        ResourcePayload payload;
+        payload.id = entry.id;
+        payload.bytes = entry.bytes;
+        payload.size = entry.size;
+        if (entry.type == rleTypeCode && options.condense) {
+            payload.type = "rlëD";
+            rles.push_back(payload);
+            rleEntries.push_back(i);
+        } else if (entry.type == pictTypeCode && options.picts) {
+            payload.type = "PICT";
+            picts.push_back(payload);
+            pictEntries.push_back(i);
+        }
     }
-
-    // Apply the mask
-    auto black = qd::color::black();
-    for (int y=0; y<spriteY; y++) {
-        for (int x=0; x<spriteX; x++) {
-            if (mask->at(x, y) == black) {
-                sprite->set(x, y, {0, 0, 0, 0});
-            }
+    bool changed = processPayloads("rlëD", rles, context);
+    changed |= processPayloads("PICT", picts, context);
+    for (size_t i=0; i<rles.size(); i++) {
+        if (rles[i].output) {
+            output[rleEntries[i]] = { dataBytes(rles[i].output), rles[i].output->size() };
         }
     }
-
-    auto rle = qd::rle(sprite, frame);
-    auto data = rle.data();
-    if (options.verbose) {
-        auto sSize = spriteRes->data()->size();
-        auto mSize = maskRes->data()->size();
-        auto rSize = data->size();
-        printf("%7lld  %7d  %6d  %6d  %6d  %11ld  %9ld  %9ld\n",
-               resource->id(), spriteID, rle.frame_count(), frame.width(), frame.height(), sSize, mSize, rSize);
+    for (size_t i=0; i<picts.size(); i++) {
+        if (picts[i].output) {
+            output[pictEntries[i]] = { dataBytes(picts[i].output), picts[i].output->size() };
+        }
     }
-    file.add_resource("rlëD", spriteID, spriteRes->name(), data);
-
-    // Remove the PICTs
-    spriteRes->remove();
-    maskRes->remove();
 
-    return true;
-}
-
-bool deRle(std::shared_ptr<rsrc::resource> resource, rsrc::file& file, int16_t spriteID, int16_t maskID, qd::size frame, int16_t gridX) {
-    if (spriteID <= 0 || maskID <= 0) {
-        return false;
-    }
-    auto rleRes = file.find("rlëD", spriteID, {}).lock();
-    if (rleRes == nullptr) {
+    // Don't rewrite file if nothing changed and outpath not provided
+    if (!changed && outpath.empty()) {
+        out << "No changes written." << std::endl;
+        finishStats();
         return false;
     }
-    if (gridX <= 0) {
-        std::cerr << "Invalid grid size in " << resource->type_code() << " " << resource->id() << "." << std::endl;
-    }
-
-    auto rle = qd::rle(rleRes->data(), 0, "", gridX);
-    if (!(frame == rle.frame_size())) {
-        std::cerr << "rlëD " << spriteID << " for " << resource->type_code() << " " << resource->id() << " does not match frame size." << std::endl;
-        return false;
+    std::error_code error;
+    bool inPlace = outpath.empty() || std::filesystem::equivalent(outpath, path, error);
+    if (outpath.empty()) {
+        outpath = path;
     }
-
-    // Separate the mask
-    auto sprite = rle.surface().lock();
-    auto spriteX = sprite->size().width();
-    auto spriteY = sprite->size().height();
-    auto black = qd::color::black();
-    auto white = qd::color::white();
-    auto mask = std::make_shared<qd::surface>(spriteX, spriteY, black);
-    for (int y=0; y<spriteY; y++) {
-        for (int x=0; x<spriteX; x++) {
-            if (sprite->at(x, y).alpha_component() == 0) {
-                sprite->set(x, y, black);
+    try {
+        PhaseTimer timer(writePhase, fileStats);
+        bool updated = false;
+        if (options.incremental && inPlace) {
+            // Compact instead once enough of the file is unused
+            auto free = fork->updateFreeSpace(output);
+            std::string report;
+            if (free > fork->size() * compactThreshold) {
+                report = stringf("Compacted, removing %zu bytes of free space.", free);
             } else {
-                mask->set(x, y, white);
+                try {
+                    if (fork->update(output) == MappedFork::tooLarge) {
+                        report = "Too large to update in place, rewritten in full.";
+                    } else {
+                        updated = true;
+                        report = stringf("Updated in place, leaving %zu bytes of free space.", free);
+                    }
+                } catch (const std::exception& e) {
+                    // Whatever was written is replaced along with the rest of the file
+                    err << filename.generic_string() << ": " << e.what() << ", rewriting in full." << std::endl;
+                }
             }
+            if (options.verbose && !report.empty()) {
+                out << report << std::endl;
+            }
+        }
+        if (!updated) {
+            fork->write(outpath.generic_string(), output);
         }
+    } catch (const std::exception&) {
+        finishStats();
+        throw;
     }
-
-    auto spritePict = qd::pict(sprite);
-    auto spriteData = spritePict.data(16);
-    auto maskPict = qd::pict(mask);
-    auto maskData = maskPict.data(1);
-    if (options.verbose) {
-        auto sSize = spriteData->size();
-        auto mSize = maskData->size();
-        auto rSize = rleRes->data()->size();
-        printf("%7lld  %7d  %6d  %6d  %6d  %11ld  %9ld  %9ld\n",
-               resource->id(), spriteID, rle.frame_count(), frame.width(), frame.height(), sSize, mSize, rSize);
-    }
-    file.add_resource("PICT", spriteID, rleRes->name(), spriteData);
-    file.add_resource("PICT", maskID, "", maskData);
-
-    // Remove the rleD
-    rleRes->remove();
-
+    finishStats();
     return true;
 }
 
-bool processSpin(std::shared_ptr<rsrc::resource> resource, rsrc::file& file) {
-    auto spin = Spin(resource);
-    if (options.encode) {
-        return enRle(resource, file, spin.spriteID, spin.maskID, spin.frame);
-    } else {
-        return deRle(resource, file, spin.spriteID, spin.maskID, spin.frame, spin.grid.width());
-    }
-}
-
-int processShan(std::shared_ptr<rsrc::resource> resource, rsrc::file& file) {
-    auto shan = Shan(resource);
-    int processed = 0;
-    if (options.encode) {
-        processed += enRle(resource, file, shan.baseSpriteID, shan.baseMaskID, shan.baseFrame);
-        processed += enRle(resource, file, shan.altSpriteID, shan.altMaskID, shan.altFrame);
-        processed += enRle(resource, file, shan.engineSpriteID, shan.engineMaskID, shan.engineFrame);
-        processed += enRle(resource, file, shan.lightSpriteID, shan.lightMaskID, shan.lightFrame);
-        processed += enRle(resource, file, shan.weaponSpriteID, shan.weaponMaskID, shan.weaponFrame);
-        processed += enRle(resource, file, shan.shieldSpriteID, shan.shieldMaskID, shan.shieldFrame);
-    } else {
-        // Work out a suitable grid width
-        int16_t gridX = 6;
-        if (shan.framesPer <= gridX) {
-            gridX = shan.framesPer;
-        } else {
-            while (shan.framesPer % gridX != 0) {
-                gridX += 1;
+typedef struct Batch {
+    size_t index;
+    std::filesystem::path path;
+    std::filesystem::path outpath;
+    // Processed through a mapping by processMappedFile() rather than loaded here
+    bool mapped = false;
+    rsrc::file file;
+    std::string error;
+    FileStats* stats = nullptr;
+} Batch;
+
+typedef struct BatchStatus {
+    enum { written, unchanged, failed } state = unchanged;
+    std::string message;
+} BatchStatus;
+
+// Number of files that may wait between stages. Together with the file in each stage this caps memory use.
+static const size_t pipelineDepth = 2;
+
+int processBatch(Engine& engine, std::vector<std::filesystem::path> paths, std::vector<std::filesystem::path> outpaths) {
+    auto& stats = engine.stats;
+    // Three stage pipeline: the next file is parsed and the previous one written while the current one is transformed.
+    // Files processed through a mapping with --mmap or --incremental go through all their stages in the middle one.
+    BoundedQueue<std::shared_ptr<Batch>> loaded(pipelineDepth);
+    BoundedQueue<std::shared_ptr<Batch>> transformed(pipelineDepth);
+    std::vector<BatchStatus> statuses(paths.size());
+
+    std::thread loader([&] {
+        for (size_t i=0; i<paths.size(); i++) {
+            auto batch = std::make_shared<Batch>();
+            batch->index = i;
+            batch->path = paths[i];
+            batch->outpath = outpaths[i];
+            batch->mapped = canMap(engine.options, batch->outpath);
+            if (batch->mapped) {
+                loaded.push(batch);
+                continue;
+            }
+            if (stats) {
+                batch->stats = stats->addFile(batch->path.filename().generic_string());
             }
-        }
-        processed += deRle(resource, file, shan.baseSpriteID, shan.baseMaskID, shan.baseFrame, gridX);
-        processed += deRle(resource, file, shan.altSpriteID, shan.altMaskID, shan.altFrame, gridX);
-        processed += deRle(resource, file, shan.engineSpriteID, shan.engineMaskID, shan.engineFrame, gridX);
-        processed += deRle(resource, file, shan.lightSpriteID, shan.lightMaskID, shan.lightFrame, gridX);
-        processed += deRle(resource, file, shan.weaponSpriteID, shan.weaponMaskID, shan.weaponFrame, gridX);
-        processed += deRle(resource, file, shan.shieldSpriteID, shan.shieldMaskID, shan.shieldFrame, gridX);
-    }
-    return processed;
-}
-
-bool processType(rsrc::file& file, std::string typeCode) {
-    auto typeList = file.type_container(typeCode).lock();
-    if (typeList->count() == 0) {
-        return false;
-    }
-    int64_t saved = 0;
-    if (typeCode == "rlëD") {
-        if (options.verbose) {
-            printf("rlëD ID  Frames  Height      Size  New Height  New Size   Saved  Action\n");
-        }
-        for (auto resource : typeList->resources()) {
             try {
-                saved += processRle(resource);
+                PhaseTimer timer(parsePhase, batch->stats);
+                batch->file = rsrc::file(batch->path.generic_string());
             } catch (const std::exception& e) {
-                std::cerr << typeCode << " " << resource->id() << ": " << e.what() << std::endl;
+                batch->error = e.what();
             }
+            loaded.push(batch);
         }
-        std::cout << "Saved " << saved << " bytes from " << typeList->count() << " rlëDs." << std::endl;
-    } else if (typeCode == "PICT") {
-        if (options.verbose) {
-            printf("PICT ID  Type        Size  New Type  New Size   Saved  Action\n");
-        }
-        for (auto resource : typeList->resources()) {
+        loaded.close();
+    });
+
+    std::thread writer([&] {
+        while (auto next = transformed.pop()) {
+            auto batch = *next;
+            auto& status = statuses[batch->index];
             try {
-                saved += processPict(resource);
+                PhaseTimer timer(writePhase, batch->stats);
+                auto format = outputFormat(engine.options, batch->file, batch->path, batch->outpath);
+                batch->file.write(batch->outpath.generic_string(), format);
+                status.state = BatchStatus::written;
             } catch (const std::exception& e) {
-                std::cerr << typeCode << " " << resource->id() << ": " << e.what() << std::endl;
+                status.state = BatchStatus::failed;
+                status.message = e.what();
+            }
+            if (batch->stats) {
+                stats->finishFile(batch->stats);
             }
         }
-        std::cout << "Saved " << saved << " bytes from " << typeList->count() << " PICTs." << std::endl;
-    } else if (typeCode == "spïn") {
-        if (options.verbose) {
-            printf("spïn ID  rlëD ID  Frames   Width  Height  Sprite Size  Mask Size  rlëD Size\n");
-        }
-        for (auto resource : typeList->resources()) {
+    });
+
+    while (auto next = loaded.pop()) {
+        auto batch = *next;
+        auto filename = batch->path.filename();
+        auto& status = statuses[batch->index];
+        if (batch->mapped) {
+            // Mapped files are read and written in place of the transform stage
             try {
-                saved += processSpin(resource, file);
+                bool written = processMappedFile(engine, batch->path, batch->outpath, std::cout, std::cerr);
+                status.state = written ? BatchStatus::written : BatchStatus::unchanged;
             } catch (const std::exception& e) {
-                std::cerr << typeCode << " " << resource->id() << ": " << e.what() << std::endl;
+                std::cerr << filename.generic_string() << ": " << e.what() << std::endl;
+                status.state = BatchStatus::failed;
+                status.message = e.what();
             }
+            continue;
         }
-        auto action = options.decode ? "Decoded" : "Encoded";
-        std::cout << action << " " << saved << " rlëDs from " << typeList->count() << " spïns." << std::endl;
-    } else if (typeCode == "shän") {
-        if (options.verbose) {
-            printf("shän ID  rlëD ID  Frames   Width  Height  Sprite Size  Mask Size  rlëD Size\n");
+        if (!batch->error.empty()) {
+            std::cerr << filename << ": " << batch->error << std::endl;
+            status.state = BatchStatus::failed;
+            status.message = batch->error;
+            if (batch->stats) {
+                stats->finishFile(batch->stats);
+            }
+            continue;
         }
-        for (auto resource : typeList->resources()) {
-            try {
-                saved += processShan(resource, file);
-            } catch (const std::exception& e) {
-                std::cerr << typeCode << " " << resource->id() << ": " << e.what() << std::endl;
+        std::cout << "Processing " << filename << "..." << std::endl;
+        FileContext context(engine, filename.generic_string(), batch->stats);
+        bool writeFile = !batch->outpath.empty();
+        writeFile |= transformFile(batch->file, context);
+        if (!writeFile) {
+            std::cout << "No changes written." << std::endl;
+            if (batch->stats) {
+                stats->finishFile(batch->stats);
             }
+            continue;
         }
-        auto action = options.decode ? "Decoded" : "Encoded";
-        std::cout << action << " " << saved << " rlëDs from " << typeList->count() << " shäns." << std::endl;
+        transformed.push(batch);
+    }
+    transformed.close();
+    loader.join();
+    writer.join();
+
+    int written = 0;
+    int unchanged = 0;
+    int failed = 0;
+    for (auto& status : statuses) {
+        switch (status.state) {
+            case BatchStatus::written: written++; break;
+            case BatchStatus::unchanged: unchanged++; break;
+            case BatchStatus::failed: failed++; break;
+        }
+    }
+    std::cout << "Summary: " << written << " written, " << unchanged << " unchanged, " << failed << " failed." << std::endl;
+    for (size_t i=0; i<paths.size(); i++) {
+        if (statuses[i].state == BatchStatus::failed) {
+            std::cout << "  " << paths[i].filename().generic_string() << ": " << statuses[i].message << std::endl;
+        }
+    }
+    return failed ? 2 : 0;
+}
+
+// Process up to --jobs files at once. Every file's resources are processed on the one work pool, so a large
+// file doesn't leave the pool idle while smaller ones wait. Each file still goes through its stages in order,
+// is written as soon as it's done, and has its output printed in one piece. A file that can't be written doesn't
+// stop the others, which may be writing in place; the run fails once they're all done.
+int processInterleaved(Engine& engine, std::vector<std::filesystem::path> paths, std::vector<std::filesystem::path> outpaths) {
+    std::atomic<size_t> next{0};
+    std::mutex printMutex;
+    std::vector<BatchStatus> statuses(paths.size());
+    // Files run on their own threads rather than as pool tasks, so a whole file is never run by a thread
+    // that's waiting on one of its own resources
+    auto fileThreads = std::min(paths.size(), static_cast<size_t>(engine.pool->jobs()));
+    std::vector<std::thread> threads;
+    for (size_t t=0; t<fileThreads; t++) {
+        threads.emplace_back([&] {
+            for (size_t i; (i = next++) < paths.size();) {
+                std::ostringstream out;
+                std::ostringstream err;
+                auto& status = statuses[i];
+                try {
+                    bool written;
+                    if (canMap(engine.options, outpaths[i])) {
+                        written = processMappedFile(engine, paths[i], outpaths[i], out, err);
+                    } else {
+                        written = processFile(engine, paths[i], outpaths[i], out, err);
+                    }
+                    status.state = written ? BatchStatus::written : BatchStatus::unchanged;
+                } catch (const std::exception& e) {
+                    err << paths[i].filename().generic_string() << ": " << e.what() << std::endl;
+                    status.state = BatchStatus::failed;
+                }
+                std::lock_guard<std::mutex> lock(printMutex);
+                std::cout << out.str() << std::flush;
+                std::cerr << err.str() << std::flush;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    bool failed = false;
+    for (auto& status : statuses) {
+        failed |= status.state == BatchStatus::failed;
     }
-    return saved != 0;
+    return failed ? 2 : 0;
 }
 
-bool processFile(std::filesystem::path path, std::filesystem::path outpath) {
+// What's known about a watched file from when it was last processed
+typedef struct WatchedFile {
+    std::filesystem::file_time_type time;
+    uintmax_t size = 0;
+    ResourceHashes settled;
+} WatchedFile;
+
+// Process a watched file that has been written, updating it in place. Only rlëDs and PICTs that changed since it
+// was last processed are processed again.
+void processWatchedFile(Engine& engine, const std::filesystem::path& path, WatchedFile& watched) {
+    auto start = std::chrono::steady_clock::now();
+    std::error_code error;
+    auto time = std::filesystem::last_write_time(path, error);
+    auto size = std::filesystem::file_size(path, error);
+    // Skip files that are gone, and writes made here
+    if (error || (time == watched.time && size == watched.size)) {
+        return;
+    }
     auto filename = path.filename();
     rsrc::file file;
     try {
         file = rsrc::file(path.generic_string());
     } catch (const std::exception& e) {
-        std::cerr << filename << ": " << e.what() << std::endl;
-        return false;
+        // Not every file in the tree is a resource file
+        if (engine.options.verbose) {
+            std::cerr << filename << ": " << e.what() << std::endl;
+        }
+        return;
     }
-    
+
     std::cout << "Processing " << filename << "..." << std::endl;
-    // Don't rewrite file if nothing changed and outpath not provided
-    bool writeFile = !outpath.empty();
-    // Process picts first if decoding rleDs, otherwise last
-    if (options.picts && options.decode) {
-        writeFile |= processType(file, "PICT");
-    }
-    // If trim is on, do encodes before processing rleDs so they can also be trimmed, otherwise encode after
-    if (options.decode || (options.encode && options.trim)) {
-        writeFile |= processType(file, "spïn");
-        writeFile |= processType(file, "shän");
-    }
-    if (options.condense) {
-        writeFile |= processType(file, "rlëD");
-    }
-    if (options.encode && !options.trim) {
-        writeFile |= processType(file, "spïn");
-        writeFile |= processType(file, "shän");
-    }
-    if (options.picts && !options.decode) {
-        writeFile |= processType(file, "PICT");
+    FileContext context(engine, filename.generic_string());
+    context.settled = &watched.settled;
+    bool changed = transformFile(file, context);
+    if (changed) {
+        // If it was saved again in the meantime, leave it for that write's event
+        if (std::filesystem::last_write_time(path, error) != time) {
+            std::cout << "Changed while processing, not written." << std::endl;
+            return;
+        }
+        std::filesystem::path outpath;
+        try {
+            file.write(path.generic_string(), outputFormat(engine.options, file, path, outpath));
+        } catch (const std::exception& e) {
+            std::cerr << filename.generic_string() << ": " << e.what() << std::endl;
+            return;
+        }
     }
-    if (!writeFile) {
+    watched.settled = resourceHashes(file);
+    watched.time = std::filesystem::last_write_time(path, error);
+    watched.size = std::filesystem::file_size(path, error);
+    if (changed) {
+        std::cout << stringf("Written in %.2fs.", elapsedNanoseconds(start) / 1e9) << std::endl;
+    } else {
         std::cout << "No changes written." << std::endl;
-        return false;
-    }
-    
-    auto format = options.forceFormat ? options.format : file.current_format();
-    if (outpath.empty()) {
-        outpath = path;
-    } else if (!options.forceFormat) {
-        // Determine format from extension
-        auto ext = outpath.extension();
-        if (ext == ".rez") {
-            format = rsrc::file::format::rez;
-        } else if (ext == ".ndat" || ext == ".npif" || ext == ".rsrc") {
-            format = rsrc::file::format::classic;
-        }
     }
+}
+
+// Process the files in a directory tree, then keep processing them as they're written. Only returns on failure.
+int watchDirectory(Engine& engine, std::filesystem::path directory) {
+    // Watch before the first pass, so nothing written during it is missed
+    std::unique_ptr<DirectoryWatcher> watcher;
     try {
-        file.write(outpath.generic_string(), format);
+        watcher = std::make_unique<DirectoryWatcher>(directory);
     } catch (const std::exception& e) {
-        std::cerr << filename.generic_string() << ": " << e.what() << std::endl;
-        exit(2);
+        std::cerr << directory << ": " << e.what() << std::endl;
+        return 1;
     }
-    return true;
+    std::map<std::filesystem::path, WatchedFile> files;
+    for (auto& path : watchedFiles(directory)) {
+        processWatchedFile(engine, path, files[path]);
+    }
+    std::cout << "Watching " << directory << " for changes..." << std::endl;
+    while (true) {
+        for (auto& path : watcher->wait()) {
+            // Forget deleted files, so a long watch doesn't keep every file that ever passed through
+            std::error_code error;
+            if (!std::filesystem::exists(path, error)) {
+                files.erase(path);
+                continue;
+            }
+            processWatchedFile(engine, path, files[path]);
+        }
+    }
+}
+
+// Estimate what processing the files would save and take from a sample of each, without writing anything
+int estimateFiles(Engine& engine, std::vector<std::filesystem::path> paths, double fraction) {
+    std::vector<TypeEstimate> totals;
+    double sampleTime = 0;
+    double projectedTime = 0;
+    size_t estimated = 0;
+    for (auto& path : paths) {
+        auto filename = path.filename();
+        rsrc::file file;
+        try {
+            file = rsrc::file(path.generic_string());
+        } catch (const std::exception& e) {
+            std::cerr << filename << ": " << e.what() << std::endl;
+            continue;
+        }
+        std::cout << "Estimating " << filename << "..." << std::endl;
+        auto estimate = estimateFile(engine, file, fraction);
+        projectedTime += printEstimates(std::cout, estimate.types);
+        sampleTime += estimate.seconds;
+        addEstimates(totals, estimate.types);
+        estimated++;
+    }
+    if (estimated > 1) {
+        std::cout << "All " << estimated << " files:" << std::endl;
+        printEstimates(std::cout, totals);
+    }
+    if (projectedTime > 0) {
+        std::cout << stringf("Sampled in %.2fs, %.0f%% of the projected processing time. Nothing was written.",
+                             sampleTime, sampleTime * 100 / projectedTime) << std::endl;
+    }
+    return estimated == paths.size() ? 0 : 1;
 }
 
 void printUsage() {
@@ -563,16 +522,33 @@ void printUsage() {
     std::cerr << "  -p --picts          normalize PICTs by rewriting them in a standard format" << std::endl;
     std::cerr << "  -r --reduce         reduce PICT depth to 16-bit (smaller output)" << std::endl;
     std::cerr << "  -e --encode         encode rlëDs from spïns/shäns with PICTs" << std::endl;
+    std::cerr << "  --stream            as -e, but encode each frame separately and in parallel to save memory" << std::endl;
     std::cerr << "  -d --decode         decode rlëDs from spïns/shäns into PICTs" << std::endl;
     std::cerr << "  -n --no-dither      don't dither when reducing to 16-bit (applies to -r and -e)" << std::endl;
+    std::cerr << "  --prescan           skip PICTs already stored the way -p would rewrite them, without decoding" << std::endl;
+    std::cerr << "  --best              try every PICT encoding and keep the smallest (slow)" << std::endl;
     std::cerr << "  -t --trim           allow rlëD frame height trimming (not recommended)" << std::endl;
+    std::cerr << "  --reencode          rewrite each rlëD line with the smallest possible opcodes" << std::endl;
+    std::cerr << "  --index             add an rlëI index of frame offsets and content bounds for each rlëD" << std::endl;
+    std::cerr << "  --verify            decode every changed resource and check its pixels against the original" << std::endl;
+    std::cerr << "  --estimate[=<pct>]  project savings and time from a sample of each file (default 5%), writing nothing" << std::endl;
     std::cerr << "  -o --output <path>  set output file/directory" << std::endl;
+    std::cerr << "  -j --jobs <count>   process resources on multiple threads (0 = all cores)" << std::endl;
+    std::cerr << "  --cache <dir>       reuse results for unchanged rlëDs and PICTs from a cache directory" << std::endl;
+    std::cerr << "  --dedup             optimize identical rlëDs and PICTs only once and report duplicates" << std::endl;
     std::cerr << "  -v --verbose        enable verbose output" << std::endl;
+    std::cerr << "  --stats=json        print per-file, type and resource timings and peak memory as JSON (report goes to stderr)" << std::endl;
+    std::cerr << "  --stats-output <path>  write the stats to a file instead" << std::endl;
+    std::cerr << "  --pipeline          overlap loading, processing and writing of multiple files" << std::endl;
+    std::cerr << "  --watch <dir>       process the files in a directory, then each file again as it's saved" << std::endl;
+    std::cerr << "  --interleave        process up to --jobs files at once, sharing one work queue" << std::endl;
+    std::cerr << "  --mmap              map classic files and only read the rlëDs/PICTs being processed (-c/-t/-p/-r)" << std::endl;
+    std::cerr << "  --incremental       as --mmap, but update files in place, appending only changed resources" << std::endl;
     std::cerr << "  --rez               force output in .rez format" << std::endl;
     std::cerr << "  --ndat              force output in .ndat format" << std::endl;
 }
 
-void processOption(std::string arg) {
+void processOption(Options& options, std::string arg) {
     if (arg == "c" || arg == "--condense") {
         options.condense = true;
     } else if (arg == "p" || arg == "--picts") {
@@ -589,8 +565,32 @@ void processOption(std::string arg) {
     } else if (arg == "t" || arg == "--trim") {
         options.condense = true;
         options.trim = true;
+    } else if (arg == "--reencode") {
+        options.condense = true;
+        options.reencode = true;
+    } else if (arg == "--index") {
+        options.index = true;
     } else if (arg == "v" || arg == "--verbose") {
         options.verbose = true;
+    } else if (arg == "--prescan") {
+        options.picts = true;
+        options.prescan = true;
+    } else if (arg == "--best") {
+        options.picts = true;
+        options.best = true;
+    } else if (arg == "--dedup") {
+        options.dedup = true;
+    } else if (arg == "--pipeline") {
+        options.pipeline = true;
+    } else if (arg == "--interleave") {
+        options.interleave = true;
+    } else if (arg == "--mmap") {
+        options.mmap = true;
+    } else if (arg == "--incremental") {
+        options.incremental = true;
+    } else if (arg == "--stream") {
+        options.encode = true;
+        options.stream = true;
     } else if (arg == "--rez") {
         options.forceFormat = true;
         options.format = rsrc::file::rez;
@@ -610,9 +610,15 @@ int main(int argc, const char * argv[]) {
         printUsage();
         return 1;
     }
+    Options options;
     std::vector<std::filesystem::path> files;
     std::filesystem::path outpath;
     bool outdir = false;
+    std::filesystem::path cachePath;
+    std::filesystem::path statsPath;
+    std::filesystem::path watchPath;
+    // Fraction of each file's resources to sample, when estimating
+    double estimate = 0;
     bool hasOptions = false;
     for (int i=1; i<argc; i++) {
         std::string arg(argv[i]);
@@ -632,11 +638,74 @@ int main(int argc, const char * argv[]) {
                         return 1;
                     }
                 }
+            } else if (arg == "-j" || arg == "--jobs") {
+                if (++i == argc) {
+                    std::cerr << arg << " option requires a value." << std::endl;
+                    return 1;
+                }
+                try {
+                    options.jobs = std::stoi(argv[i]);
+                } catch (const std::exception& e) {
+                    options.jobs = -1;
+                }
+                if (options.jobs < 0) {
+                    std::cerr << "Invalid job count: " << argv[i] << std::endl;
+                    return 1;
+                }
+                if (options.jobs == 0) {
+                    options.jobs = std::max(1u, std::thread::hardware_concurrency());
+                }
+                continue;
+            } else if (arg == "--cache") {
+                if (++i == argc) {
+                    std::cerr << arg << " option requires a value." << std::endl;
+                    return 1;
+                }
+                cachePath = std::filesystem::path(argv[i]);
+                continue;
+            } else if (arg == "--watch") {
+                if (++i == argc) {
+                    std::cerr << arg << " option requires a value." << std::endl;
+                    return 1;
+                }
+                watchPath = std::filesystem::path(argv[i]);
+                continue;
+            } else if (arg == "--estimate" || arg.rfind("--estimate=", 0) == 0) {
+                estimate = 0.05;
+                if (arg.size() > 10) {
+                    try {
+                        estimate = std::stod(arg.substr(11)) / 100;
+                    } catch (const std::exception& e) {
+                        estimate = -1;
+                    }
+                    if (estimate <= 0 || estimate > 1) {
+                        std::cerr << "Invalid sample percentage: " << arg.substr(11) << std::endl;
+                        return 1;
+                    }
+                }
+                continue;
+            } else if (arg == "--verify") {
+                options.verify = true;
+                continue;
+            } else if (arg.rfind("--stats=", 0) == 0) {
+                if (arg != "--stats=json") {
+                    std::cerr << "Unsupported stats format: " << arg.substr(8) << std::endl;
+                    return 1;
+                }
+                options.stats = true;
+                continue;
+            } else if (arg == "--stats-output") {
+                if (++i == argc) {
+                    std::cerr << arg << " option requires a value." << std::endl;
+                    return 1;
+                }
+                statsPath = std::filesystem::path(argv[i]);
+                continue;
             } else if (arg[1] == '-') {
-                processOption(arg);
+                processOption(options, arg);
             } else {
                 for (int j=1; j<arg.size(); j++) {
-                    processOption(arg.substr(j, 1));
+                    processOption(options, arg.substr(j, 1));
                 }
             }
             hasOptions = true;
@@ -644,16 +713,69 @@ int main(int argc, const char * argv[]) {
             files.emplace_back(std::filesystem::path(arg));
         }
     }
-    if (!files.size()) {
+    if (!watchPath.empty()) {
+        if (!files.empty() || !outpath.empty() || options.forceFormat || options.pipeline || options.interleave ||
+            options.mmap || options.incremental) {
+            std::cerr << "--watch updates files in place by itself, so it can't be combined with files, -o, --rez, "
+                      << "--ndat, --pipeline, --interleave, --mmap or --incremental." << std::endl;
+            return 1;
+        }
+        // Duplicates would pile up without end, and a resource saved again unchanged would match itself
+        if (options.dedup) {
+            std::cerr << "--watch never finishes a run to report duplicates, so it can't be combined with --dedup. "
+                      << "Use --cache to reuse results instead." << std::endl;
+            return 1;
+        }
+    } else if (!files.size()) {
         std::cerr << "No files provided." << std::endl;
         printUsage();
         return 1;
     }
+    if (options.pipeline && options.interleave) {
+        std::cerr << "--pipeline and --interleave are different ways of overlapping files, so they can't be combined."
+                  << std::endl;
+        return 1;
+    }
+    if (estimate > 0 && (!watchPath.empty() || !outpath.empty() || options.forceFormat || options.pipeline ||
+                         options.interleave || options.mmap || options.incremental || options.dedup || !cachePath.empty())) {
+        std::cerr << "--estimate doesn't write anything, and processes a sample without reusing results, so it can't "
+                  << "be combined with --watch, -o, --rez, --ndat, --pipeline, --interleave, --mmap, --incremental, "
+                  << "--dedup or --cache." << std::endl;
+        return 1;
+    }
     if (!hasOptions) {
         options.condense = true;
     }
+    Engine engine(options);
+    if (options.stats || !statsPath.empty()) {
+        engine.stats = std::make_unique<StatsCollector>();
+    }
+    if (options.dedup) {
+        engine.dedup = std::make_unique<ResultDedup>();
+    }
+    if (!cachePath.empty()) {
+        try {
+            engine.cache = std::make_unique<ResultCache>(cachePath);
+        } catch (const std::exception& e) {
+            std::cerr << "Cache directory " << cachePath << ": " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    if (!watchPath.empty()) {
+        return watchDirectory(engine, watchPath);
+    }
+    if (estimate > 0) {
+        return estimateFiles(engine, files, estimate);
+    }
+
+    // With stats printed to stdout, the report goes to stderr so stdout only has the JSON on it
+    std::streambuf* statsBuffer = nullptr;
+    if (engine.stats && statsPath.empty()) {
+        statsBuffer = std::cout.rdbuf(std::cerr.rdbuf());
+    }
 
     auto ext = options.format == rsrc::file::classic ? "ndat" : "rez";
+    std::vector<std::filesystem::path> outfiles;
     for (auto file : files) {
         auto outfile = outdir ? outpath / file.filename() : outpath;
         if (options.forceFormat && outfile.empty()) {
@@ -661,7 +783,51 @@ int main(int argc, const char * argv[]) {
         } else if (options.forceFormat && outdir) {
             outfile.replace_extension(ext);
         }
-        processFile(file, outfile);
+        outfiles.push_back(outfile);
+    }
+    int status = 0;
+    if (options.pipeline) {
+        status = processBatch(engine, files, outfiles);
+    } else if (options.interleave) {
+        status = processInterleaved(engine, files, outfiles);
+    } else {
+        for (size_t i=0; i<files.size(); i++) {
+            try {
+                if (canMap(options, outfiles[i])) {
+                    processMappedFile(engine, files[i], outfiles[i], std::cout, std::cerr);
+                } else {
+                    processFile(engine, files[i], outfiles[i], std::cout, std::cerr);
+                }
+            } catch (const std::exception& e) {
+                std::cerr << files[i].filename().generic_string() << ": " << e.what() << std::endl;
+                return 2;
+            }
+        }
+    }
+    if (engine.dedup) {
+        engine.dedup->report(std::cout, options.verbose);
+    }
+    if (engine.cache) {
+        std::cout << "Cache: " << engine.cache->hits() << " hits, " << engine.cache->misses() << " misses." << std::endl;
+    }
+    if (options.verbose) {
+        // Reuse of per-thread scratch buffers: allocations beyond the heap blocks were served from reused memory
+        auto scratch = Arena::statistics();
+        std::cout << "Scratch memory: " << scratch.allocations << " allocations from " << scratch.blocks
+                  << " heap blocks, " << scratch.reserved / 1024 << " KB held." << std::endl;
+    }
+    if (engine.stats) {
+        if (statsPath.empty()) {
+            std::cout.rdbuf(statsBuffer);
+            engine.stats->writeJson(std::cout);
+        } else {
+            std::ofstream out(statsPath);
+            engine.stats->writeJson(out);
+            if (!out) {
+                std::cerr << "Could not write stats to " << statsPath << "." << std::endl;
+                return 1;
+            }
+        }
     }
-    return 0;
+    return status;
 }
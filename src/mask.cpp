@@ -0,0 +1,200 @@
+//
+//  mask.cpp
+//  rleduce
+//
+
+#include "mask.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MASK_SSE2 1
+#endif
+
+// Reverse the bits of each byte, to turn movemask output (first pixel lowest) into QuickDraw bit order
+static const struct BitReverse {
+    uint8_t table[256];
+    BitReverse() {
+        for (int i=0; i<256; i++) {
+            uint8_t value = 0;
+            for (int bit=0; bit<8; bit++) {
+                if (i & (1 << bit)) {
+                    value |= 0x80 >> bit;
+                }
+            }
+            table[i] = value;
+        }
+    }
+} bitReverse;
+
+void applyMaskRow(uint8_t* pixels, const uint8_t* mask, int width, uint32_t match) {
+    int x = 0;
+#if MASK_SSE2
+    auto matches = _mm_set1_epi32(static_cast<int>(match));
+    for (; x+4 <= width; x += 4) {
+        auto maskPixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask + x * 4));
+        auto spritePixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + x * 4));
+        auto masked = _mm_cmpeq_epi32(maskPixels, matches);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pixels + x * 4), _mm_andnot_si128(masked, spritePixels));
+    }
+#endif
+    for (; x<width; x++) {
+        uint32_t pixel;
+        memcpy(&pixel, mask + x * 4, 4);
+        if (pixel == match) {
+            memset(pixels + x * 4, 0, 4);
+        }
+    }
+}
+
+void splitMaskRow(uint8_t* pixels, int width, uint32_t fill, uint8_t* bits) {
+    auto alpha = packPixel(0, 0, 0, 255);
+    memset(bits, 0, maskRowBytes(width));
+    int x = 0;
+#if MASK_SSE2
+    auto alphas = _mm_set1_epi32(static_cast<int>(alpha));
+    auto fills = _mm_set1_epi32(static_cast<int>(fill));
+    auto zero = _mm_setzero_si128();
+    for (; x+8 <= width; x += 8) {
+        int found = 0;
+        for (int half=0; half<2; half++) {
+            auto address = reinterpret_cast<__m128i*>(pixels + (x + half * 4) * 4);
+            auto values = _mm_loadu_si128(address);
+            auto transparent = _mm_cmpeq_epi32(_mm_and_si128(values, alphas), zero);
+            values = _mm_or_si128(_mm_and_si128(transparent, fills), _mm_andnot_si128(transparent, values));
+            _mm_storeu_si128(address, values);
+            found |= _mm_movemask_ps(_mm_castsi128_ps(transparent)) << (half * 4);
+        }
+        bits[x / 8] = bitReverse.table[found];
+    }
+#endif
+    for (; x<width; x++) {
+        uint32_t pixel;
+        memcpy(&pixel, pixels + x * 4, 4);
+        if ((pixel & alpha) == 0) {
+            memcpy(pixels + x * 4, &fill, 4);
+            bits[x / 8] |= 0x80 >> (x % 8);
+        }
+    }
+}
+
+static void writeShort(std::vector<char>& out, int value) {
+    out.push_back(static_cast<char>(value >> 8));
+    out.push_back(static_cast<char>(value));
+}
+
+static void writeLong(std::vector<char>& out, uint32_t value) {
+    writeShort(out, value >> 16);
+    writeShort(out, value & 0xFFFF);
+}
+
+static void writeRect(std::vector<char>& out, int width, int height) {
+    writeShort(out, 0);
+    writeShort(out, 0);
+    writeShort(out, height);
+    writeShort(out, width);
+}
+
+// PackBits compression of a single row. Runs of three or more bytes are repeated, anything else is literal.
+static void packBits(const uint8_t* row, int count, std::vector<char>& out) {
+    int i = 0;
+    while (i < count) {
+        int run = 1;
+        while (i + run < count && run < 128 && row[i + run] == row[i]) {
+            run++;
+        }
+        if (run >= 3) {
+            out.push_back(static_cast<char>(1 - run));
+            out.push_back(static_cast<char>(row[i]));
+            i += run;
+            continue;
+        }
+        int start = i;
+        while (i < count && i - start < 128) {
+            if (i + 2 < count && row[i] == row[i + 1] && row[i] == row[i + 2]) {
+                break;
+            }
+            i++;
+        }
+        out.push_back(static_cast<char>(i - start - 1));
+        out.insert(out.end(), row + start, row + i);
+    }
+}
+
+std::vector<char> maskPict(const uint8_t* bits, int width, int height) {
+    auto rowBytes = maskRowBytes(width);
+    std::vector<char> out;
+    out.reserve(128 + rowBytes * height);
+    // Picture size, patched at the end, and frame
+    writeShort(out, 0);
+    writeRect(out, width, height);
+    // Version 2 header
+    writeShort(out, 0x0011);
+    writeShort(out, 0x02FF);
+    writeShort(out, 0x0C00);
+    writeShort(out, 0xFFFE);
+    writeShort(out, 0);
+    writeLong(out, 0x00480000);
+    writeLong(out, 0x00480000);
+    writeRect(out, width, height);
+    writeLong(out, 0);
+    // Clip region
+    writeShort(out, 0x0001);
+    writeShort(out, 10);
+    writeRect(out, width, height);
+
+    // PackBitsRect with a 1-bit pixmap and a white/black colour table
+    writeShort(out, 0x0098);
+    writeShort(out, rowBytes | 0x8000);
+    writeRect(out, width, height);
+    writeShort(out, 0);             // pmVersion
+    writeShort(out, 0);             // packType
+    writeLong(out, 0);              // packSize
+    writeLong(out, 0x00480000);     // hRes
+    writeLong(out, 0x00480000);     // vRes
+    writeShort(out, 0);             // pixelType
+    writeShort(out, 1);             // pixelSize
+    writeShort(out, 1);             // cmpCount
+    writeShort(out, 1);             // cmpSize
+    writeLong(out, 0);              // planeBytes
+    writeLong(out, 0);              // pmTable
+    writeLong(out, 0);              // pmReserved
+    writeLong(out, 0);              // ctSeed
+    writeShort(out, 0);             // ctFlags
+    writeShort(out, 1);             // ctSize
+    writeShort(out, 0);
+    writeShort(out, 0xFFFF);
+    writeShort(out, 0xFFFF);
+    writeShort(out, 0xFFFF);
+    writeShort(out, 1);
+    writeShort(out, 0);
+    writeShort(out, 0);
+    writeShort(out, 0);
+    writeRect(out, width, height);  // srcRect
+    writeRect(out, width, height);  // dstRect
+    writeShort(out, 0);             // srcCopy
+
+    std::vector<char> packed;
+    for (int y=0; y<height; y++) {
+        auto row = bits + y * rowBytes;
+        if (rowBytes < 8) {
+            out.insert(out.end(), row, row + rowBytes);
+            continue;
+        }
+        packed.clear();
+        packBits(row, rowBytes, packed);
+        if (rowBytes > 250) {
+            writeShort(out, static_cast<int>(packed.size()));
+        } else {
+            out.push_back(static_cast<char>(packed.size()));
+        }
+        out.insert(out.end(), packed.begin(), packed.end());
+    }
+    if (out.size() % 2) {
+        out.push_back(0);
+    }
+    writeShort(out, 0x00FF);
+
+    out[0] = static_cast<char>(out.size() >> 8);
+    out[1] = static_cast<char>(out.size());
+    return out;
+}
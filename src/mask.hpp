@@ -0,0 +1,36 @@
+//
+//  mask.hpp
+//  rleduce
+//
+
+#ifndef mask_hpp
+#define mask_hpp
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// A pixel in the same byte order as the RGBA rows, for comparisons a whole pixel at a time
+inline uint32_t packPixel(uint8_t red, uint8_t green, uint8_t blue, uint8_t alpha) {
+    uint8_t bytes[4] = { red, green, blue, alpha };
+    uint32_t pixel;
+    memcpy(&pixel, bytes, 4);
+    return pixel;
+}
+
+// Bytes per row of a 1-bit mask, padded to an even length as QuickDraw requires
+inline int maskRowBytes(int width) {
+    return ((width + 15) / 16) * 2;
+}
+
+// Clear each RGBA pixel (to transparent black) where the corresponding mask pixel matches the given colour.
+void applyMaskRow(uint8_t* pixels, const uint8_t* mask, int width, uint32_t match);
+
+// Replace each transparent RGBA pixel with the fill colour and set its bit in the 1-bit mask row.
+// Opaque pixels have their bit cleared. Bits are packed most significant first.
+void splitMaskRow(uint8_t* pixels, int width, uint32_t fill, uint8_t* bits);
+
+// Encode a 1-bit mask as a PICT. Set bits are black.
+std::vector<char> maskPict(const uint8_t* bits, int width, int height);
+
+#endif /* mask_hpp */
@@ -0,0 +1,170 @@
+//
+//  pictscan.cpp
+//  rleduce
+//
+
+#include <algorithm>
+#include <stdexcept>
+#include "pictscan.hpp"
+
+enum pictop : uint16_t {
+    nop = 0x0000,
+    clipRegion = 0x0001,
+    version = 0x0011,
+    defHilite = 0x001E,
+    packBitsRect = 0x0098,
+    packBitsRegion = 0x0099,
+    directBitsRect = 0x009A,
+    directBitsRegion = 0x009B,
+    shortComment = 0x00A0,
+    longComment = 0x00A1,
+    endPicture = 0x00FF,
+    extendedHeader = 0x0C00,
+    compressedQuickTime = 0x8200,
+    uncompressedQuickTime = 0x8201,
+};
+
+static uint16_t readShort(const char* bytes, size_t size, size_t pos) {
+    if (pos + 2 > size) {
+        throw std::out_of_range("Unexpected end of PICT data");
+    }
+    auto p = reinterpret_cast<const uint8_t*>(bytes + pos);
+    return p[0] << 8 | p[1];
+}
+
+static uint32_t readLong(const char* bytes, size_t size, size_t pos) {
+    return static_cast<uint32_t>(readShort(bytes, size, pos)) << 16 | readShort(bytes, size, pos + 2);
+}
+
+static uint8_t readByte(const char* bytes, size_t size, size_t pos) {
+    if (pos >= size) {
+        throw std::out_of_range("Unexpected end of PICT data");
+    }
+    return static_cast<uint8_t>(bytes[pos]);
+}
+
+// Position after the image data of a pixel opcode. Rows are packed with a byte count each unless they're
+// short or stored unpacked.
+static size_t skipRows(const char* bytes, size_t size, size_t pos, int rowBytes, int height, int packType) {
+    if (rowBytes < 8 || packType == 1) {
+        return pos + static_cast<size_t>(rowBytes) * height;
+    }
+    if (packType == 2) {
+        // 32-bit pixels with the unused byte dropped
+        return pos + static_cast<size_t>(rowBytes) * 3 / 4 * height;
+    }
+    for (int y=0; y<height; y++) {
+        if (rowBytes > 250) {
+            pos += 2 + readShort(bytes, size, pos);
+        } else {
+            pos += 1 + readByte(bytes, size, pos);
+        }
+    }
+    return pos;
+}
+
+// Position after a PackBits or DirectBits opcode's data, adding its encoding to the scan
+static size_t scanPixels(const char* bytes, size_t size, size_t pos, uint16_t op, PictScan& scan) {
+    bool direct = op == directBitsRect || op == directBitsRegion;
+    if (direct) {
+        // Base address
+        pos += 4;
+    }
+    int rowBytes = readShort(bytes, size, pos);
+    bool pixMap = rowBytes & 0x8000;
+    rowBytes &= 0x3FFF;
+    int height = static_cast<int16_t>(readShort(bytes, size, pos + 6)) - static_cast<int16_t>(readShort(bytes, size, pos + 2));
+    if (height < 0) {
+        throw std::invalid_argument("Invalid PICT bounds");
+    }
+    pos += 10;
+    int packType = 0;
+    int pixelSize = 1;
+    int cmpCount = 1;
+    int cmpSize = 1;
+    if (pixMap) {
+        packType = readShort(bytes, size, pos + 2);
+        pixelSize = readShort(bytes, size, pos + 18);
+        cmpCount = readShort(bytes, size, pos + 20);
+        cmpSize = readShort(bytes, size, pos + 22);
+        pos += 36;
+        if (!direct) {
+            // Colour table
+            int entries = readShort(bytes, size, pos + 6) + 1;
+            pos += 8 + entries * 8;
+        }
+    } else if (direct) {
+        throw std::invalid_argument("DirectBits without a pixel map");
+    }
+    // Source and destination rects and transfer mode
+    pos += 18;
+    if (op == packBitsRegion || op == directBitsRegion) {
+        pos += readShort(bytes, size, pos);
+    }
+    // Packing only applies to pixel sizes of 8 or more, with 0 meaning the default for the size
+    if (pixelSize < 8) {
+        packType = 0;
+    }
+    pos = skipRows(bytes, size, pos, rowBytes, height, packType);
+    scan.depth = std::max(scan.depth, pixelSize);
+    scan.layout.insert(scan.layout.end(), {
+        static_cast<uint32_t>(pixelSize), static_cast<uint32_t>(packType),
+        static_cast<uint32_t>(cmpCount), static_cast<uint32_t>(cmpSize)
+    });
+    return pos;
+}
+
+PictScan scanPict(const char* bytes, size_t size) {
+    PictScan scan;
+    try {
+        // Picture size and frame, then the version opcode
+        size_t pos = 10;
+        if (readShort(bytes, size, pos) != version || readShort(bytes, size, pos + 2) != 0x02FF) {
+            return scan;
+        }
+        pos += 4;
+        while (true) {
+            auto op = readShort(bytes, size, pos);
+            pos += 2;
+            scan.layout.push_back(op);
+            switch (op) {
+                case nop:
+                case defHilite:
+                    break;
+                case extendedHeader:
+                    pos += 24;
+                    break;
+                case clipRegion:
+                    pos += readShort(bytes, size, pos);
+                    break;
+                case shortComment:
+                    pos += 2;
+                    break;
+                case longComment:
+                    pos += 4 + readShort(bytes, size, pos + 2);
+                    break;
+                case packBitsRect:
+                case packBitsRegion:
+                case directBitsRect:
+                case directBitsRegion:
+                    pos = scanPixels(bytes, size, pos, op, scan);
+                    break;
+                case compressedQuickTime:
+                case uncompressedQuickTime:
+                    scan.quickTime = true;
+                    pos += 4 + readLong(bytes, size, pos);
+                    break;
+                case endPicture:
+                    scan.complete = true;
+                    return scan;
+                default:
+                    return scan;
+            }
+            // Opcodes are word aligned in version 2
+            pos += pos % 2;
+        }
+    } catch (const std::exception&) {
+        scan.complete = false;
+    }
+    return scan;
+}
@@ -0,0 +1,28 @@
+//
+//  pictscan.hpp
+//  rleduce
+//
+
+#ifndef pictscan_hpp
+#define pictscan_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// What a walk of a PICT's opcodes shows about how it is encoded, without decoding any pixels
+typedef struct PictScan {
+    // Whether every opcode was understood, up to the end of the picture
+    bool complete = false;
+    bool quickTime = false;
+    // Bits per pixel of the deepest image, 0 if there is none
+    int depth = 0;
+    // Each opcode followed by the fields that decide how its pixels are stored: pixel size, pack type,
+    // component count and size. Two PICTs with the same layout were written the same way.
+    std::vector<uint32_t> layout;
+} PictScan;
+
+// Scan a version 2 PICT. Version 1 PICTs and anything unrecognised leave the scan incomplete.
+PictScan scanPict(const char* bytes, size_t size);
+
+#endif /* pictscan_hpp */
@@ -0,0 +1,57 @@
+//
+//  pipeline.hpp
+//  rleduce
+//
+
+#ifndef pipeline_hpp
+#define pipeline_hpp
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+// Fixed capacity queue connecting two pipeline stages.
+// push() blocks while the queue is full, which limits how much work can be in flight.
+// pop() blocks until an item is available, or returns nothing once the queue is closed and drained.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return items.size() < capacity; });
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+    }
+
+    std::optional<T> pop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return !items.empty() || closed; });
+        if (items.empty()) {
+            return std::nullopt;
+        }
+        auto item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return item;
+    }
+
+    // Signal that no more items will be pushed.
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+private:
+    size_t capacity;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    bool closed = false;
+};
+
+#endif /* pipeline_hpp */
@@ -0,0 +1,42 @@
+//
+//  pixels.cpp
+//  rleduce
+//
+
+#include <cstring>
+#include "pixels.hpp"
+
+bool exactRgb555(const uint8_t* pixels, size_t count, const DitherTables& tables) {
+    for (size_t i=0; i<count; i++, pixels += 4) {
+        if (tables.red[pixels[0]] != pixels[0] || tables.green[pixels[1]] != pixels[1] || tables.blue[pixels[2]] != pixels[2]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void packRgb555Row(const uint8_t* pixels, const uint8_t* mask, int width, uint32_t match,
+                   const Rgb555Tables& tables, int32_t* values) {
+    for (int x=0; x<width; x++, pixels += 4, mask += 4) {
+        uint32_t maskPixel;
+        memcpy(&maskPixel, mask, 4);
+        if (maskPixel == match || pixels[3] == 0) {
+            values[x] = -1;
+        } else {
+            values[x] = tables.red[pixels[0]] | tables.green[pixels[1]] | tables.blue[pixels[2]];
+        }
+    }
+}
+
+bool matchesSplit(const uint8_t* pixels, const uint8_t* sprite, const uint8_t* mask, size_t count) {
+    for (size_t i=0; i<count; i++, pixels += 4, sprite += 4, mask += 4) {
+        bool masked = mask[0] == 0 && mask[1] == 0 && mask[2] == 0;
+        if (masked != (pixels[3] == 0)) {
+            return false;
+        }
+        if (!masked && (sprite[0] != pixels[0] || sprite[1] != pixels[1] || sprite[2] != pixels[2])) {
+            return false;
+        }
+    }
+    return true;
+}
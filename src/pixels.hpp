@@ -0,0 +1,80 @@
+//
+//  pixels.hpp
+//  rleduce
+//
+
+#ifndef pixels_hpp
+#define pixels_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include "dither.hpp"
+
+// Contribution of each colour component to an rgb555 value. These are filled from the colour conversion
+// in use so packed values match it exactly.
+typedef struct Rgb555Tables {
+    uint16_t red[256];
+    uint16_t green[256];
+    uint16_t blue[256];
+} Rgb555Tables;
+
+// How the pixels of a decoded image were stored, which decides the work needed to reduce them to rgb555
+enum PixelSource {
+    // 1 to 8-bit, from a colour table
+    indexedSource,
+    // 16-bit, already rgb555
+    rgb555Source,
+    // 24 or 32-bit
+    directSource,
+};
+
+inline PixelSource pixelSource(uint32_t format) {
+    return format <= 8 ? indexedSource : format == 16 ? rgb555Source : directSource;
+}
+
+// Whether every RGBA pixel is already a colour rgb555 holds exactly, so dithering would leave it unchanged
+bool exactRgb555(const uint8_t* pixels, size_t count, const DitherTables& tables);
+
+// Dither RGBA rows to rgb555 in place, splitting wide images across the pool if given. Returns false if there
+// was nothing to change.
+// Images from 16-bit pixels are already exact. A colour table usually has few colours that aren't, so indexed
+// images are checked first and only dithered if needed; direct images are always dithered.
+template <PixelSource Source>
+bool reduceRgb555(uint8_t* pixels, int width, int height, const DitherTables& tables, WorkPool* pool) {
+    if constexpr (Source == rgb555Source) {
+        return false;
+    } else {
+        if constexpr (Source == indexedSource) {
+            if (exactRgb555(pixels, static_cast<size_t>(width) * height, tables)) {
+                return false;
+            }
+        }
+        ditherRgb555(pixels, width, height, tables, pool);
+        return true;
+    }
+}
+
+typedef bool (*ReduceRgb555)(uint8_t* pixels, int width, int height, const DitherTables& tables, WorkPool* pool);
+
+// The reduction for an image's format, chosen once per image
+inline ReduceRgb555 selectReduceRgb555(uint32_t format) {
+    switch (pixelSource(format)) {
+        case indexedSource:
+            return reduceRgb555<indexedSource>;
+        case rgb555Source:
+            return reduceRgb555<rgb555Source>;
+        default:
+            return reduceRgb555<directSource>;
+    }
+}
+
+// Pack a row of RGBA pixels into rlëD pixel values, applying the mask in the same pass.
+// Pixels are -1 (transparent) where the mask pixel matches the given colour or the pixel has no alpha.
+void packRgb555Row(const uint8_t* pixels, const uint8_t* mask, int width, uint32_t match,
+                   const Rgb555Tables& tables, int32_t* values);
+
+// Whether decoded sprite and mask images match the RGBA pixels they were split from. Transparent pixels must be
+// black in the mask, and opaque ones not black in the mask and the same colour in the sprite.
+bool matchesSplit(const uint8_t* pixels, const uint8_t* sprite, const uint8_t* mask, size_t count);
+
+#endif /* pixels_hpp */
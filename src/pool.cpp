@@ -0,0 +1,155 @@
+//
+//  pool.cpp
+//  rleduce
+//
+
+#include <utility>
+#include "arena.hpp"
+#include "pool.hpp"
+
+static thread_local const WorkPool* currentPool = nullptr;
+static thread_local size_t currentIndex = 0;
+
+WorkPool::WorkPool(int jobs) {
+    if (jobs < 1) {
+        jobs = 1;
+    }
+    // One queue per worker plus a shared queue for tasks submitted from outside the pool
+    for (int i=0; i<jobs; i++) {
+        queues.emplace_back(std::make_unique<Queue>());
+    }
+    for (int i=0; i<jobs-1; i++) {
+        threads.emplace_back(&WorkPool::work, this, i);
+    }
+}
+
+WorkPool::~WorkPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+int WorkPool::jobs() const {
+    return static_cast<int>(queues.size());
+}
+
+size_t WorkPool::localQueue() const {
+    return currentPool == this ? currentIndex : queues.size() - 1;
+}
+
+void WorkPool::submit(Group& group, std::function<void()> task) {
+    group.pending++;
+    auto& queue = *queues[localQueue()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back({&group, std::move(task)});
+    }
+    queued++;
+    {
+        // Synchronise with sleepers so the wakeup can't be lost
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wake.notify_one();
+}
+
+bool WorkPool::runOne(size_t home) {
+    Task task;
+    bool found = false;
+    {
+        // Own tasks are taken newest first, which keeps nested work close to its parent
+        auto& queue = *queues[home];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            found = true;
+        }
+    }
+    if (!found) {
+        // Steal the oldest task from another queue, starting at a different victim each time
+        auto count = queues.size();
+        auto start = nextQueue++;
+        for (size_t i=0; i<count && !found; i++) {
+            auto& queue = *queues[(start + i) % count];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.tasks.empty()) {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+                found = true;
+            }
+        }
+    }
+    if (!found) {
+        return false;
+    }
+    queued--;
+    // Finish the task even if it throws, so its group's waiter isn't left waiting
+    struct Finish {
+        WorkPool& pool;
+        Group& group;
+
+        ~Finish() {
+            if (--group.pending == 0) {
+                {
+                    std::lock_guard<std::mutex> lock(pool.sleepMutex);
+                }
+                pool.wake.notify_all();
+            }
+        }
+    } finish{*this, *task.group};
+    try {
+        // Scratch memory the task allocates is released for the next task on this thread
+        ArenaScope scope;
+        task.run();
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(finish.group.mutex);
+        if (!finish.group.error) {
+            finish.group.error = std::current_exception();
+        }
+    }
+    return true;
+}
+
+void WorkPool::work(size_t index) {
+    currentPool = this;
+    currentIndex = index;
+    while (true) {
+        if (runOne(index)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this] { return stopping || queued > 0; });
+        if (stopping && queued == 0) {
+            return;
+        }
+    }
+}
+
+void WorkPool::wait(Group& group) {
+    auto home = localQueue();
+    while (group.pending > 0) {
+        if (runOne(home)) {
+            continue;
+        }
+        // Nothing left to run, but other threads are still busy with this group
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [&] { return group.pending == 0 || queued > 0; });
+    }
+    std::lock_guard<std::mutex> lock(group.mutex);
+    if (group.error) {
+        std::rethrow_exception(std::exchange(group.error, nullptr));
+    }
+}
+
+void WorkPool::parallelFor(size_t count, const std::function<void(size_t)>& fn) {
+    Group group;
+    for (size_t i=0; i<count; i++) {
+        submit(group, [&fn, i] { fn(i); });
+    }
+    wait(group);
+}
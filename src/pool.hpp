@@ -0,0 +1,71 @@
+//
+//  pool.hpp
+//  rleduce
+//
+
+#ifndef pool_hpp
+#define pool_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool.
+// Each worker owns a deque: it pops its own tasks from the back and steals from the front of the
+// other deques when it runs dry. Threads that wait on a group help run tasks rather than sleeping,
+// so the calling thread counts as one of the jobs and groups may be waited on from within a task.
+class WorkPool {
+public:
+    // A set of tasks that can be waited on together. The first exception thrown by any of them is rethrown by wait().
+    class Group {
+    public:
+        Group() = default;
+        Group(const Group&) = delete;
+    private:
+        friend class WorkPool;
+        std::atomic<size_t> pending{0};
+        std::mutex mutex;
+        std::exception_ptr error;
+    };
+
+    // Create a pool that runs `jobs` tasks at once, including the waiting thread.
+    explicit WorkPool(int jobs);
+    ~WorkPool();
+
+    int jobs() const;
+    void submit(Group& group, std::function<void()> task);
+    void wait(Group& group);
+
+    // Run fn(i) for each i in [0, count) and wait for all of them to finish.
+    void parallelFor(size_t count, const std::function<void(size_t)>& fn);
+
+private:
+    struct Task {
+        Group* group;
+        std::function<void()> run;
+    };
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> nextQueue{0};
+    std::atomic<size_t> queued{0};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    size_t localQueue() const;
+    bool runOne(size_t home);
+    void work(size_t index);
+};
+
+#endif /* pool_hpp */
@@ -0,0 +1,271 @@
+//
+//  resfork.cpp
+//  rleduce
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "resfork.hpp"
+
+static const size_t headerSize = 16;
+
+static uint32_t readLong(const char* bytes) {
+    auto p = reinterpret_cast<const uint8_t*>(bytes);
+    return p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static uint16_t readShort(const char* bytes) {
+    auto p = reinterpret_cast<const uint8_t*>(bytes);
+    return static_cast<uint16_t>(p[0] << 8 | p[1]);
+}
+
+static void writeLong(char* bytes, uint32_t value) {
+    bytes[0] = static_cast<char>(value >> 24);
+    bytes[1] = static_cast<char>(value >> 16);
+    bytes[2] = static_cast<char>(value >> 8);
+    bytes[3] = static_cast<char>(value);
+}
+
+MappedFork::MappedFork(const std::string& path) : path(path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open file");
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(headerSize)) {
+        close(fd);
+        throw std::runtime_error("Not a resource file");
+    }
+    length = info.st_size;
+    mode = info.st_mode & 07777;
+    auto mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("Could not map file");
+    }
+    base = static_cast<const char*>(mapping);
+    try {
+        parse();
+    } catch (...) {
+        munmap(const_cast<char*>(base), length);
+        throw;
+    }
+}
+
+MappedFork::~MappedFork() {
+    munmap(const_cast<char*>(base), length);
+}
+
+void MappedFork::parse() {
+    auto invalid = [] {
+        return std::runtime_error("Not a classic resource fork");
+    };
+    dataOffset = readLong(base);
+    mapOffset = readLong(base + 4);
+    auto dataLength = readLong(base + 8);
+    mapLength = readLong(base + 12);
+    if (dataOffset < headerSize || mapLength < 30 || static_cast<uint64_t>(dataOffset) + dataLength > length ||
+        static_cast<uint64_t>(mapOffset) + mapLength > length || mapOffset < dataOffset + dataLength) {
+        throw invalid();
+    }
+    auto map = base + mapOffset;
+    size_t typeListOffset = readShort(map + 24);
+    if (typeListOffset + 2 > mapLength) {
+        throw invalid();
+    }
+    auto typeList = map + typeListOffset;
+    // Stored as one less than the count, so an empty map has 0xFFFF
+    int types = (readShort(typeList) + 1) & 0xFFFF;
+    if (typeListOffset + 2 + types * 8 > mapLength) {
+        throw invalid();
+    }
+    for (int t=0; t<types; t++) {
+        auto type = typeList + 2 + t * 8;
+        auto code = readLong(type);
+        int count = readShort(type + 4) + 1;
+        size_t references = typeListOffset + readShort(type + 6);
+        if (references + count * 12 > mapLength) {
+            throw invalid();
+        }
+        for (int r=0; r<count; r++) {
+            auto reference = map + references + r * 12;
+            uint32_t offset = readLong(reference + 4) & 0x00FFFFFF;
+            if (static_cast<uint64_t>(offset) + 4 > dataLength) {
+                throw invalid();
+            }
+            auto size = readLong(base + dataOffset + offset);
+            if (static_cast<uint64_t>(offset) + 4 + size > dataLength) {
+                throw invalid();
+            }
+            Entry entry;
+            entry.type = code;
+            entry.id = static_cast<int16_t>(readShort(reference));
+            entry.bytes = base + dataOffset + offset + 4;
+            entry.size = size;
+            entry.reference = references + r * 12;
+            entry.offset = offset;
+            list.push_back(entry);
+        }
+    }
+}
+
+void MappedFork::write(const std::string& path, const std::vector<std::pair<const char*, size_t>>& payloads) const {
+    // Keep the data in its original order, so an unchanged fork is written out identically
+    std::vector<size_t> order(list.size());
+    for (size_t i=0; i<order.size(); i++) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return list[a].offset < list[b].offset;
+    });
+
+    std::vector<char> map(base + mapOffset, base + mapOffset + mapLength);
+    uint32_t dataLength = 0;
+    for (auto i : order) {
+        if (dataLength > 0x00FFFFFF) {
+            throw std::runtime_error("Resource data too large for a classic resource fork");
+        }
+        auto reference = map.data() + list[i].reference;
+        writeLong(reference + 4, (readLong(reference + 4) & 0xFF000000) | dataLength);
+        dataLength += 4 + static_cast<uint32_t>(payloads[i].second);
+    }
+    // The header, and its copy at the start of the map, are the only other things that change
+    char header[headerSize];
+    writeLong(header, dataOffset);
+    writeLong(header + 4, dataOffset + dataLength);
+    writeLong(header + 8, dataLength);
+    writeLong(header + 12, mapLength);
+    memcpy(map.data(), header, headerSize);
+
+    std::random_device random;
+    auto temp = path + ".tmp" + std::to_string(random());
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_EXCL, mode);
+    if (fd < 0) {
+        throw std::runtime_error("Could not write file");
+    }
+    FILE* out = fdopen(fd, "wb");
+    if (!out) {
+        close(fd);
+        unlink(temp.c_str());
+        throw std::runtime_error("Could not write file");
+    }
+    // Keep the original's permissions, which the umask may have narrowed when creating the file
+    bool ok = fchmod(fd, mode) == 0;
+    auto put = [&](const char* bytes, size_t count) {
+        ok = ok && fwrite(bytes, 1, count, out) == count;
+    };
+    put(header, headerSize);
+    // Reserved and application data between the header and the resource data are kept as is
+    put(base + headerSize, dataOffset - headerSize);
+    for (auto i : order) {
+        char size[4];
+        writeLong(size, static_cast<uint32_t>(payloads[i].second));
+        put(size, 4);
+        put(payloads[i].first, payloads[i].second);
+    }
+    put(map.data(), map.size());
+    ok = fclose(out) == 0 && ok;
+    if (!ok || rename(temp.c_str(), path.c_str()) != 0) {
+        unlink(temp.c_str());
+        throw std::runtime_error("Could not write file");
+    }
+}
+
+bool MappedFork::changed(size_t index, const std::pair<const char*, size_t>& payload) const {
+    return payload.first != list[index].bytes || payload.second != list[index].size;
+}
+
+size_t MappedFork::updateFreeSpace(const std::vector<std::pair<const char*, size_t>>& payloads) const {
+    // The data section grows to take in the old map and the appended payloads
+    uint64_t dataLength = length - dataOffset;
+    uint64_t used = 0;
+    std::vector<uint32_t> offsets;
+    for (size_t i=0; i<list.size(); i++) {
+        if (changed(i, payloads[i])) {
+            dataLength += 4 + payloads[i].second;
+            used += 4 + payloads[i].second;
+        } else {
+            offsets.push_back(list[i].offset);
+        }
+    }
+    // Unchanged resources may share data
+    std::sort(offsets.begin(), offsets.end());
+    for (size_t i=0; i<offsets.size(); i++) {
+        if (i == 0 || offsets[i] != offsets[i-1]) {
+            used += 4 + readLong(base + dataOffset + offsets[i]);
+        }
+    }
+    return dataLength - used;
+}
+
+MappedFork::UpdateResult MappedFork::update(const std::vector<std::pair<const char*, size_t>>& payloads) const {
+    std::vector<char> map(base + mapOffset, base + mapOffset + mapLength);
+    uint64_t dataLength = length - dataOffset;
+    for (size_t i=0; i<list.size(); i++) {
+        if (!changed(i, payloads[i])) {
+            continue;
+        }
+        if (dataLength > 0x00FFFFFF) {
+            return tooLarge;
+        }
+        auto reference = map.data() + list[i].reference;
+        writeLong(reference + 4, (readLong(reference + 4) & 0xFF000000) | static_cast<uint32_t>(dataLength));
+        dataLength += 4 + payloads[i].second;
+    }
+    if (dataOffset + dataLength + mapLength > 0xFFFFFFFF) {
+        return tooLarge;
+    }
+    char header[headerSize];
+    writeLong(header, dataOffset);
+    writeLong(header + 4, static_cast<uint32_t>(dataOffset + dataLength));
+    writeLong(header + 8, static_cast<uint32_t>(dataLength));
+    writeLong(header + 12, mapLength);
+    memcpy(map.data(), header, headerSize);
+
+    int fd = open(path.c_str(), O_WRONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open file for writing");
+    }
+    auto writeAt = [&](const char* bytes, size_t count, off_t offset) {
+        while (count > 0) {
+            auto written = pwrite(fd, bytes, count, offset);
+            if (written < 0) {
+                close(fd);
+                throw std::runtime_error("Could not write file");
+            }
+            bytes += written;
+            count -= written;
+            offset += written;
+        }
+    };
+    off_t end = length;
+    for (size_t i=0; i<list.size(); i++) {
+        if (!changed(i, payloads[i])) {
+            continue;
+        }
+        char size[4];
+        writeLong(size, static_cast<uint32_t>(payloads[i].second));
+        writeAt(size, 4, end);
+        writeAt(payloads[i].first, payloads[i].second, end + 4);
+        end += 4 + payloads[i].second;
+    }
+    writeAt(map.data(), map.size(), end);
+    // Everything the new header points to must be on disk before the header itself
+    if (fsync(fd) != 0) {
+        close(fd);
+        throw std::runtime_error("Could not write file");
+    }
+    writeAt(header, headerSize, 0);
+    bool synced = fsync(fd) == 0;
+    if (close(fd) != 0 || !synced) {
+        throw std::runtime_error("Could not write file");
+    }
+    return updated;
+}
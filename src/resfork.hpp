@@ -0,0 +1,78 @@
+//
+//  resfork.hpp
+//  rleduce
+//
+
+#ifndef resfork_hpp
+#define resfork_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// MacRoman type codes, as stored in a resource fork
+static const uint32_t rleTypeCode = 0x726C9144;     // 'rlëD'
+static const uint32_t pictTypeCode = 0x50494354;    // 'PICT'
+static const uint32_t rleIndexTypeCode = 0x726C9149; // 'rlëI'
+
+// A classic resource fork, memory-mapped read-only so payloads are only paged in when they're used.
+// Only the map is parsed up front.
+class MappedFork {
+public:
+    typedef struct Entry {
+        uint32_t type;
+        int16_t id;
+        const char* bytes;
+        uint32_t size;
+        // Offset of the entry's reference in the map, so its data offset can be rewritten
+        size_t reference;
+        // Offset of the payload's length in the data section
+        uint32_t offset;
+    } Entry;
+
+    // Throws std::runtime_error if the file can't be mapped or isn't a classic resource fork
+    MappedFork(const std::string& path);
+    ~MappedFork();
+    MappedFork(const MappedFork&) = delete;
+    MappedFork& operator=(const MappedFork&) = delete;
+
+    const std::vector<Entry>& entries() const { return list; }
+    size_t size() const { return length; }
+
+    // Write the fork with the given payload for each entry, in the same order as entries().
+    // Payloads that still point into the mapping are written straight from it.
+    // The output goes to a temporary file that replaces the destination, so it may be the mapped file itself.
+    // It's given the mapped file's permissions. Throws std::runtime_error if it can't be written.
+    void write(const std::string& path, const std::vector<std::pair<const char*, size_t>>& payloads) const;
+
+    // Bytes of the data section that no resource would use after an update() with these payloads
+    size_t updateFreeSpace(const std::vector<std::pair<const char*, size_t>>& payloads) const;
+
+    enum UpdateResult {
+        updated,
+        // Nothing was changed, as appending would go past the offsets a classic fork can hold
+        tooLarge,
+    };
+
+    // Update the mapped file in place. Unchanged payloads stay where they are, changed ones and a new map are
+    // appended, and the header is written last so the file stays valid if interrupted before then.
+    // Throws std::runtime_error if any of it can't be written and synced, in which case write() should replace it.
+    UpdateResult update(const std::vector<std::pair<const char*, size_t>>& payloads) const;
+
+private:
+    std::string path;
+    const char* base = nullptr;
+    size_t length = 0;
+    mode_t mode = 0;
+    uint32_t dataOffset = 0;
+    uint32_t mapOffset = 0;
+    uint32_t mapLength = 0;
+    std::vector<Entry> list;
+
+    void parse();
+    bool changed(size_t index, const std::pair<const char*, size_t>& payload) const;
+};
+
+#endif /* resfork_hpp */
@@ -0,0 +1,1375 @@
+//
+//  rleduce.cpp
+//  rleduce
+//
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdarg>
+#include <cstring>
+#include <iostream>
+#include <set>
+#include <stdexcept>
+#include <unordered_set>
+#include "libGraphite/data/reader.hpp"
+#include "libGraphite/data/writer.hpp"
+#include "libGraphite/quickdraw/pict.hpp"
+#include "arena.hpp"
+#include "condense.hpp"
+#include "decodecache.hpp"
+#include "dither.hpp"
+#include "hash.hpp"
+#include "mask.hpp"
+#include "pictscan.hpp"
+#include "pixels.hpp"
+#include "rleduce.hpp"
+using namespace graphite;
+
+typedef struct Spin {
+    int16_t spriteID;
+    int16_t maskID;
+    qd::size frame;
+    qd::size grid;
+
+    Spin(std::shared_ptr<data::data> data) {
+        auto reader = data::reader(data);
+        spriteID = reader.read_short();
+        maskID = reader.read_short();
+        frame = qd::size::read(reader, qd::size::pict);
+        grid = qd::size::read(reader, qd::size::pict);
+    }
+} Spin;
+
+typedef struct Shan {
+    int16_t baseSpriteID;
+    int16_t baseMaskID;
+    int16_t baseSetCount;
+    qd::size baseFrame;
+    int16_t altSpriteID;
+    int16_t altMaskID;
+    int16_t altSetCount;
+    qd::size altFrame;
+    int16_t engineSpriteID;
+    int16_t engineMaskID;
+    qd::size engineFrame;
+    int16_t lightSpriteID;
+    int16_t lightMaskID;
+    qd::size lightFrame;
+    int16_t weaponSpriteID;
+    int16_t weaponMaskID;
+    qd::size weaponFrame;
+    int16_t framesPer;
+    int16_t shieldSpriteID;
+    int16_t shieldMaskID;
+    qd::size shieldFrame;
+
+    Shan(std::shared_ptr<data::data> data) {
+        auto reader = data::reader(data);
+        baseSpriteID = reader.read_short();
+        baseMaskID = reader.read_short();
+        baseSetCount = reader.read_short();
+        baseFrame = qd::size::read(reader, qd::size::pict);
+        reader.move(2);
+
+        altSpriteID = reader.read_short();
+        altMaskID = reader.read_short();
+        altSetCount = reader.read_short();
+        altFrame = qd::size::read(reader, qd::size::pict);
+
+        engineSpriteID = reader.read_short();
+        engineMaskID = reader.read_short();
+        engineFrame = qd::size::read(reader, qd::size::pict);
+
+        lightSpriteID = reader.read_short();
+        lightMaskID = reader.read_short();
+        lightFrame = qd::size::read(reader, qd::size::pict);
+
+        weaponSpriteID = reader.read_short();
+        weaponMaskID = reader.read_short();
+        weaponFrame = qd::size::read(reader, qd::size::pict);
+
+        reader.move(6);
+        framesPer = reader.read_short();
+        reader.move(10);
+
+        shieldSpriteID = reader.read_short();
+        shieldMaskID = reader.read_short();
+        shieldFrame = qd::size::read(reader, qd::size::pict);
+    }
+} Shan;
+
+std::string stringf(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    char buffer[256];
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    return buffer;
+}
+
+const char* dataBytes(std::shared_ptr<data::data> data) {
+    return data->get()->data() + data->start();
+}
+
+std::shared_ptr<data::data> makeData(std::vector<char> bytes) {
+    auto vector = std::make_shared<std::vector<char>>(std::move(bytes));
+    return std::make_shared<data::data>(vector, vector->size());
+}
+
+ResourcePayload resourcePayload(std::shared_ptr<rsrc::resource> resource) {
+    ResourcePayload payload;
+    payload.type = resource->type_code();
+    payload.id = resource->id();
+    payload.source = resource->data();
+    payload.bytes = dataBytes(payload.source);
+    payload.size = payload.source->size();
+    return payload;
+}
+
+// The payload as Graphite data, copying it only if it didn't come from Graphite
+static std::shared_ptr<data::data> sourceData(const ResourcePayload& payload) {
+    if (payload.source) {
+        return payload.source;
+    }
+    return makeData(std::vector<char>(payload.bytes, payload.bytes + payload.size));
+}
+
+// Bump this when a codec change means previously cached results are no longer valid
+static const uint64_t cacheVersion = 2;
+// Seed for the second hash that confirms a key's input, independent of the first
+static const uint64_t checkSeed = 0x726C6564756365ULL;
+
+// Hash of a resource's data, the kind of processing and the options that affect the output
+static uint64_t resultHash(const Options& options, const ResourcePayload& payload, char kind, uint64_t seed) {
+    auto hash = hash64(payload.bytes, payload.size, seed);
+    hash = hashCombine(hash, kind);
+    if (kind == 'r') {
+        hash = hashCombine(hash, options.trim);
+        hash = hashCombine(hash, options.reencode);
+    } else {
+        hash = hashCombine(hash, options.reduce);
+        hash = hashCombine(hash, options.dither);
+        hash = hashCombine(hash, options.reduce ? 16 : 24);
+        hash = hashCombine(hash, options.best);
+    }
+    return hash;
+}
+
+// Key for a resource's result, from two independently seeded hashes of the same input
+ResultKey resultKey(const Options& options, const ResourcePayload& payload, char kind) {
+    ResultKey key;
+    key.hash = resultHash(options, payload, kind, cacheVersion);
+    key.check = resultHash(options, payload, kind, checkSeed ^ cacheVersion);
+    key.size = payload.size;
+    return key;
+}
+
+// Look for an existing result for this data, from a resource with the same payload or from the cache.
+// If there is none the caller must compute the result and pass it to storeResult() or failResult().
+bool findResult(const Engine& engine, const ResultKey& key, const ResourcePayload& payload, CacheEntry& entry, Result& result) {
+    auto& cache = engine.cache;
+    auto& dedup = engine.dedup;
+    if (dedup) {
+        auto location = payload.file + ":" + payload.type + " " + std::to_string(payload.id);
+        if (dedup->acquire(key, location, entry)) {
+            result.reused = true;
+            return true;
+        }
+    }
+    if (cache && cache->load(key, entry)) {
+        if (dedup) {
+            dedup->publish(key, entry);
+        }
+        return true;
+    }
+    return false;
+}
+
+void storeResult(const Engine& engine, const ResultKey& key, const CacheEntry& entry) {
+    if (engine.cache) {
+        engine.cache->store(key, entry);
+    }
+    if (engine.dedup) {
+        engine.dedup->publish(key, entry);
+    }
+}
+
+void failResult(const Engine& engine, const ResultKey& key) {
+    if (engine.dedup) {
+        engine.dedup->fail(key, std::current_exception());
+    }
+}
+
+// Check that a condensed rlëD decodes to the same frames as the original
+static void verifyRle(const ResourcePayload& payload, const std::vector<char>& data) {
+    PhaseTimer timer(verifyPhase);
+    if (!sameRleFrames(payload.bytes, payload.size, data.data(), data.size())) {
+        throw std::runtime_error("Verification failed, decoded frames differ");
+    }
+}
+
+int64_t processRle(const Engine& engine, ResourcePayload& payload, Result& result) {
+    ArenaScope scope;
+    auto& options = engine.options;
+    auto size = payload.size;
+    RleCondensed rle;
+    CacheEntry entry;
+    auto key = resultKey(options, payload, 'r');
+    bool found = findResult(engine, key, payload, entry, result);
+    if (found) {
+        rle.frames = entry.info[0];
+        rle.height = entry.info[1];
+        rle.newHeight = entry.info[2];
+        rle.size = entry.info[3];
+        rle.data = std::move(entry.data);
+    } else {
+        try {
+            PhaseTimer timer(encodePhase);
+            rle = condenseRle(payload.bytes, size, options.trim, options.reencode);
+        } catch (...) {
+            failResult(engine, key);
+            throw;
+        }
+    }
+    if (options.verify && rle.size < size) {
+        try {
+            verifyRle(payload, rle.data);
+        } catch (...) {
+            if (!found) {
+                failResult(engine, key);
+            }
+            throw;
+        }
+        result.verified = true;
+    }
+    if (!found && (engine.cache || engine.dedup)) {
+        entry.write = rle.size < size;
+        entry.info = { rle.frames, rle.height, rle.newHeight, static_cast<int64_t>(rle.size) };
+        entry.data = rle.data;
+        storeResult(engine, key, entry);
+    }
+    int64_t diff = size - rle.size;
+    if (options.verbose) {
+        double pc = diff * 100.0 / size;
+        std::string action = diff > 0 ? "Written" : "Not written";
+        if (result.reused) {
+            action += " (duplicate)";
+        }
+        if (result.verified) {
+            action += " (verified)";
+        }
+        result.row = stringf("%7lld  %6d  %6d  %8ld  %10d  %8ld  %5.1f%%  %s\n",
+                             payload.id, rle.frames, rle.height, size, rle.newHeight, rle.size, pc, action.c_str());
+    }
+    if (diff > 0) {
+        payload.output = makeData(std::move(rle.data));
+        return diff;
+    }
+    return 0;
+}
+
+// Reduction tables taken from qd::color, so the dither matches its rgb555 conversion exactly
+static const DitherTables& ditherTables() {
+    static const DitherTables tables = [] {
+        DitherTables tables;
+        for (int i=0; i<256; i++) {
+            tables.red[i] = qd::color(qd::color(i, 0, 0).rgb555()).red_component();
+            tables.green[i] = qd::color(qd::color(0, i, 0).rgb555()).green_component();
+            tables.blue[i] = qd::color(qd::color(0, 0, i).rgb555()).blue_component();
+            tables.alpha[i] = qd::color(qd::color(0, 0, 0, i).rgb555()).alpha_component();
+        }
+        return tables;
+    }();
+    return tables;
+}
+
+// Packing tables taken from qd::color, so rlëD pixel values match its rgb555 conversion exactly
+static const Rgb555Tables& rgb555Tables() {
+    static const Rgb555Tables tables = [] {
+        Rgb555Tables tables;
+        for (int i=0; i<256; i++) {
+            tables.red[i] = qd::color(i, 0, 0).rgb555();
+            tables.green[i] = qd::color(0, i, 0).rgb555();
+            tables.blue[i] = qd::color(0, 0, i).rgb555();
+        }
+        return tables;
+    }();
+    return tables;
+}
+
+// Copy part of a surface out to raw RGBA rows for the pixel kernels
+static void readPixels(std::shared_ptr<qd::surface> surface, int left, int top, int width, int height, ScratchVector<uint8_t>& pixels) {
+    pixels.resize(width * height * 4);
+    auto pixel = pixels.data();
+    for (int y=top; y<top+height; y++) {
+        for (int x=left; x<left+width; x++) {
+            auto color = surface->at(x, y);
+            *pixel++ = color.red_component();
+            *pixel++ = color.green_component();
+            *pixel++ = color.blue_component();
+            *pixel++ = color.alpha_component();
+        }
+    }
+}
+
+// Copy a surface out to raw RGBA rows for the pixel kernels
+ScratchVector<uint8_t> readPixels(std::shared_ptr<qd::surface> surface) {
+    auto width = surface->size().width();
+    auto height = surface->size().height();
+    ScratchVector<uint8_t> pixels(width * height * 4);
+    auto pixel = pixels.data();
+    for (int y=0; y<height; y++) {
+        for (int x=0; x<width; x++) {
+            auto color = surface->at(x, y);
+            *pixel++ = color.red_component();
+            *pixel++ = color.green_component();
+            *pixel++ = color.blue_component();
+            *pixel++ = color.alpha_component();
+        }
+    }
+    return pixels;
+}
+
+void writePixels(std::shared_ptr<qd::surface> surface, const ScratchVector<uint8_t>& pixels) {
+    auto width = surface->size().width();
+    auto height = surface->size().height();
+    auto pixel = pixels.data();
+    for (int y=0; y<height; y++) {
+        for (int x=0; x<width; x++, pixel += 4) {
+            surface->set(x, y, qd::color(pixel[0], pixel[1], pixel[2], pixel[3]));
+        }
+    }
+}
+
+uint32_t packPixel(qd::color color) {
+    return packPixel(color.red_component(), color.green_component(), color.blue_component(), color.alpha_component());
+}
+
+void rgb555dither(std::shared_ptr<qd::surface> surface, uint32_t format, WorkPool* pool) {
+    auto reduce = selectReduceRgb555(format);
+    if (reduce == reduceRgb555<rgb555Source>) {
+        return;
+    }
+    ArenaScope scope;
+    auto pixels = readPixels(surface);
+    if (reduce(pixels.data(), surface->size().width(), surface->size().height(), ditherTables(), pool)) {
+        writePixels(surface, pixels);
+    }
+}
+
+std::string fourCC(uint32_t code) {
+    std::string str;
+    str.push_back(code >> 24);
+    str.push_back(code >> 16);
+    str.push_back(code >> 8);
+    str.push_back(code);
+    return str;
+}
+
+// Whether two RGBA buffers have the same colours, ignoring alpha
+bool sameColours(const ScratchVector<uint8_t>& a, const ScratchVector<uint8_t>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i=0; i<a.size(); i += 4) {
+        if (a[i] != b[i] || a[i+1] != b[i+1] || a[i+2] != b[i+2]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool fitsPalette(const ScratchVector<uint8_t>& pixels, size_t limit) {
+    std::unordered_set<uint32_t> colours;
+    for (size_t i=0; i<pixels.size(); i += 4) {
+        colours.insert(packPixel(pixels[i], pixels[i+1], pixels[i+2], 0));
+        if (colours.size() > limit) {
+            return false;
+        }
+    }
+    return true;
+}
+
+typedef struct Encoding {
+    // Depth requested for this encoding, 0 for the standard one
+    int depth = 0;
+    uint32_t format = 0;
+    std::shared_ptr<data::data> data;
+} Encoding;
+
+// Encode the image at each depth that can hold it without loss and return the smallest result.
+// The standard encoding, which is always acceptable, is passed in as the starting point.
+Encoding bestEncoding(const Engine& engine, std::shared_ptr<qd::surface> surface, Encoding standard) {
+    auto pixels = readPixels(surface);
+    std::vector<int> depths;
+    if (fitsPalette(pixels, 256)) {
+        depths.push_back(8);
+    }
+    depths.push_back(16);
+    if (!engine.options.reduce) {
+        depths.push_back(24);
+    }
+    std::vector<Encoding> candidates(depths.size());
+    engine.pool->parallelFor(depths.size(), [&](size_t i) {
+        try {
+            auto pict = qd::pict(std::make_shared<qd::surface>(*surface));
+            auto data = pict.data(depths[i]);
+            // Discard anything that doesn't decode back to the same image
+            auto decoded = qd::pict(data);
+            if (sameColours(readPixels(decoded.image_surface().lock()), pixels)) {
+                candidates[i] = { depths[i], pict.format(), data };
+            }
+        } catch (const std::exception&) {
+            // Not a valid encoding for this image
+        }
+    });
+    auto best = standard;
+    for (auto& candidate : candidates) {
+        if (candidate.data && candidate.data->size() < best.data->size()) {
+            best = candidate;
+        }
+    }
+    return best;
+}
+
+// The layout of a PICT as written at a depth, found by encoding a small image. Empty if that fails.
+static const std::vector<uint32_t>& standardLayout(int depth) {
+    static const auto layouts = [] {
+        auto surface = std::make_shared<qd::surface>(64, 8);
+        for (int y=0; y<8; y++) {
+            for (int x=0; x<64; x++) {
+                surface->set(x, y, qd::color(x * 4, y * 32, (x ^ y) * 4));
+            }
+        }
+        std::array<std::vector<uint32_t>, 2> layouts;
+        for (int i=0; i<2; i++) {
+            try {
+                auto data = qd::pict(surface).data(i ? 24 : 16);
+                auto scan = scanPict(dataBytes(data), data->size());
+                if (scan.complete) {
+                    layouts[i] = scan.layout;
+                }
+            } catch (const std::exception&) {
+                // Never matched, so nothing is skipped
+            }
+        }
+        return layouts;
+    }();
+    return layouts[depth == 16 ? 0 : 1];
+}
+
+// Whether the PICT is already stored exactly as processing would write it, in which case a re-encode
+// can only reproduce it. QuickTime PICTs and those that need reducing always need processing.
+static bool isStandardPict(const Options& options, const ResourcePayload& payload, int& depth) {
+    auto scan = scanPict(payload.bytes, payload.size);
+    depth = scan.depth;
+    if (!scan.complete || scan.quickTime || (options.reduce && scan.depth != 16)) {
+        return false;
+    }
+    auto& layout = standardLayout(options.reduce || scan.depth == 16 ? 16 : 24);
+    return !layout.empty() && scan.layout == layout;
+}
+
+// Whether processing dithers a PICT of this format. Low depth images aren't dithered.
+static bool dithersPict(const Options& options, uint32_t format) {
+    return options.reduce && options.dither && format > 4 && format != 16;
+}
+
+// Check that a PICT's new data decodes to the original's pixels, as reduced by processing. The expected pixels
+// are decoded from the original if they weren't kept while processing it.
+static void verifyPict(const Options& options, const ResourcePayload& payload, uint32_t format, int bestDepth,
+                       ScratchVector<uint8_t>& expected, std::shared_ptr<data::data> data) {
+    PhaseTimer timer(verifyPhase);
+    if (expected.empty()) {
+        auto surface = qd::pict(sourceData(payload)).image_surface().lock();
+        if (dithersPict(options, format)) {
+            rgb555dither(surface, format);
+        }
+        expected = readPixels(surface);
+    }
+    // The standard 16-bit encoding reduces every pixel to rgb555, while a best encoding is only kept if lossless
+    if (bestDepth == 0 && (options.reduce || format == 16)) {
+        auto& tables = ditherTables();
+        for (size_t i=0; i<expected.size(); i += 4) {
+            expected[i] = tables.red[expected[i]];
+            expected[i+1] = tables.green[expected[i+1]];
+            expected[i+2] = tables.blue[expected[i+2]];
+        }
+    }
+    auto decoded = readPixels(qd::pict(data).image_surface().lock());
+    if (!sameColours(expected, decoded)) {
+        throw std::runtime_error("Verification failed, decoded pixels differ");
+    }
+}
+
+int64_t processPict(const Engine& engine, ResourcePayload& payload, Result& result) {
+    ArenaScope scope;
+    auto& options = engine.options;
+    auto size = payload.size;
+    int depth;
+    if (options.prescan && !options.best && isStandardPict(options, payload, depth)) {
+        result.skipped = true;
+        if (options.verbose) {
+            auto format = std::to_string(depth) + "-bit";
+            result.row = stringf("%7lld  %-6s  %8ld  %-8s  %8ld  %5.1f%%  %s\n",
+                                 payload.id, format.c_str(), size, format.c_str(), size, 0.0, "Skipped (pre-scan)");
+        }
+        return 0;
+    }
+    uint32_t format;
+    uint32_t newFormat;
+    size_t newSize;
+    int bestDepth = 0;
+    std::shared_ptr<data::data> data;
+    // Pixels the new data should decode to, when verifying
+    ScratchVector<uint8_t> expected;
+    CacheEntry entry;
+    auto key = resultKey(options, payload, 'p');
+    bool found = findResult(engine, key, payload, entry, result);
+    if (found) {
+        format = static_cast<uint32_t>(entry.info[0]);
+        newFormat = static_cast<uint32_t>(entry.info[1]);
+        newSize = entry.info[2];
+        bestDepth = static_cast<int>(entry.info[3]);
+        data = makeData(std::move(entry.data));
+    } else {
+        try {
+            PhaseTimer decodeTimer(decodePhase);
+            qd::pict pict(sourceData(payload));
+            decodeTimer.stop();
+            format = pict.format();
+            if (dithersPict(options, format)) {
+                PhaseTimer timer(ditherPhase);
+                rgb555dither(pict.image_surface().lock(), format, engine.pool.get());
+            }
+            if (options.verify) {
+                PhaseTimer timer(verifyPhase);
+                expected = readPixels(pict.image_surface().lock());
+            }
+            PhaseTimer encodeTimer(encodePhase);
+            auto maxDepth = options.reduce || format == 16 ? 16 : 24;
+            data = pict.data(maxDepth);
+            newFormat = pict.format();
+            if (options.best) {
+                auto best = bestEncoding(engine, pict.image_surface().lock(), { 0, newFormat, data });
+                bestDepth = best.depth;
+                newFormat = best.format;
+                data = best.data;
+            }
+            newSize = data->size();
+        } catch (...) {
+            failResult(engine, key);
+            throw;
+        }
+    }
+    int64_t diff = size - newSize;
+    // Force write if format is non-standard (QuickTime) or reduction occurred
+    bool save = diff > 0 || format > 32 || (options.reduce && format != 16);
+    if (options.verify && save) {
+        try {
+            verifyPict(options, payload, format, bestDepth, expected, data);
+        } catch (...) {
+            if (!found) {
+                failResult(engine, key);
+            }
+            throw;
+        }
+        result.verified = true;
+    }
+    if ((engine.cache || engine.dedup) && !found) {
+        entry.write = save;
+        entry.info = { format, newFormat, static_cast<int64_t>(newSize), bestDepth };
+        if (save) {
+            entry.data.assign(dataBytes(data), dataBytes(data) + newSize);
+        }
+        storeResult(engine, key, entry);
+    }
+    if (options.verbose) {
+        std::string inFormat = format > 32 ? fourCC(format) : std::to_string(format)+"-bit";
+        std::string outFormat = newFormat > 32 ? fourCC(newFormat) : std::to_string(newFormat)+"-bit";
+        double pc = diff * 100.0 / size;
+        std::string action = save ? (diff > 0 ? "Written" : "Written (forced)") : "Not written";
+        if (options.best) {
+            action += bestDepth ? " (best: " + std::to_string(bestDepth) + "-bit)" : " (best: standard)";
+        }
+        if (result.reused) {
+            action += " (duplicate)";
+        }
+        if (result.verified) {
+            action += " (verified)";
+        }
+        result.row = stringf("%7lld  %-6s  %8ld  %-8s  %8ld  %5.1f%%  %s\n",
+                             payload.id, inFormat.c_str(), size, outFormat.c_str(), newSize, pc, action.c_str());
+    }
+    if (save) {
+        payload.output = data;
+        return diff;
+    }
+    return 0;
+}
+
+// Encode a sheet one frame at a time, spread across the pool. Each frame is copied out, dithered, masked and
+// encoded on its own, so only a frame's worth of pixels is held per task rather than copies of the whole sheet.
+// Dithering is per frame, so error isn't diffused across frame edges as it is when dithering the whole sheet.
+static std::shared_ptr<data::data> streamRle(WorkPool& pool, std::shared_ptr<qd::surface> sprite, std::shared_ptr<qd::surface> mask, qd::size frame, ReduceRgb555 reduce, bool verify) {
+    auto width = frame.width();
+    auto height = frame.height();
+    auto columns = sprite->size().width() / width;
+    auto count = columns * (sprite->size().height() / height);
+    std::vector<std::vector<char>> frames(count);
+    std::atomic<bool> mismatched{false};
+    auto resource = ResourceScope::current();
+    pool.parallelFor(count, [&](size_t i) {
+        ResourceScope scope(resource);
+        auto left = static_cast<int>(i % columns) * width;
+        auto top = static_cast<int>(i / columns) * height;
+        ScratchVector<uint8_t> pixels;
+        readPixels(sprite, left, top, width, height, pixels);
+        if (reduce) {
+            PhaseTimer timer(ditherPhase);
+            // Frames are already spread across the pool
+            reduce(pixels.data(), width, height, ditherTables(), nullptr);
+        }
+
+        // The mask is applied while packing
+        PhaseTimer encodeTimer(encodePhase);
+        ScratchVector<uint8_t> maskPixels;
+        readPixels(mask, left, top, width, height, maskPixels);
+        auto black = packPixel(qd::color::black());
+        auto& tables = rgb555Tables();
+        ScratchVector<int32_t> values(width * height);
+        for (int y=0; y<height; y++) {
+            auto offset = y * width;
+            packRgb555Row(pixels.data() + offset * 4, maskPixels.data() + offset * 4, width, black, tables, values.data() + offset);
+        }
+        encodeRleFrame(values.data(), width, height, frames[i]);
+        encodeTimer.stop();
+        if (verify) {
+            PhaseTimer timer(verifyPhase);
+            auto& bytes = frames[i];
+            ScratchVector<int32_t> decoded(values.size());
+            size_t pos = 0;
+            try {
+                if (!decodeRleFrame(bytes.data(), bytes.size(), pos, width, height, decoded.data()) ||
+                    pos != bytes.size() || decoded != values) {
+                    mismatched = true;
+                }
+            } catch (const std::exception&) {
+                mismatched = true;
+            }
+        }
+    });
+    if (mismatched) {
+        throw std::runtime_error("Verification failed, decoded frames differ");
+    }
+
+    std::vector<char> out;
+    size_t size = 16;
+    for (auto& bytes : frames) {
+        size += bytes.size();
+    }
+    out.reserve(size);
+    writeRleHeader(width, height, count, out);
+    for (auto& bytes : frames) {
+        out.insert(out.end(), bytes.begin(), bytes.end());
+    }
+    return makeData(std::move(out));
+}
+
+// One sprite layer of a spïn or shän. Layers are converted without touching the file, so they can run concurrently,
+// and the results are added to the file afterwards.
+typedef struct Layer {
+    std::shared_ptr<rsrc::resource> owner;
+    int16_t spriteID = 0;
+    int16_t maskID = 0;
+    qd::size frame;
+    int16_t gridX = 0;
+    // The rlëD being decoded
+    std::shared_ptr<rsrc::resource> source;
+    bool done = false;
+    std::string name;
+    std::shared_ptr<data::data> rle;
+    std::shared_ptr<data::data> sprite;
+    std::shared_ptr<data::data> mask;
+    std::string row;
+    std::string error;
+} Layer;
+
+// State shared by all the spïns and shäns converted in a file
+typedef struct SpriteSession {
+    FileContext& context;
+    // Whether layers are encoded from PICTs into rlëDs, or decoded from rlëDs into PICTs
+    bool encode;
+    DecodeCache decodes;
+    // Sprite IDs already converted, so layers that share one only convert it once
+    std::set<int16_t> converted;
+    // Resources to remove once everything that might share them is done
+    std::set<std::pair<std::string, int16_t>> removals;
+
+    SpriteSession(rsrc::file& file, FileContext& context, bool encode) : context(context), encode(encode), decodes(file) {}
+} SpriteSession;
+
+static std::string ownerName(const Layer& layer) {
+    return layer.owner->type_code() + " " + std::to_string(layer.owner->id());
+}
+
+// Check that an rlëD encoded from a sheet decodes to the sheet's pixels after masking, frame by frame
+static void verifySheet(const ScratchVector<uint8_t>& pixels, const ScratchVector<uint8_t>& mask, int sheetWidth,
+                        qd::size frame, std::shared_ptr<data::data> rle) {
+    PhaseTimer timer(verifyPhase);
+    auto width = frame.width();
+    auto height = frame.height();
+    auto columns = sheetWidth / width;
+    auto count = pixels.size() / 4 / (width * height);
+    ScratchVector<int32_t> decoded;
+    bool same = decodeRleFrames(dataBytes(rle), rle->size(), decoded) && decoded.size() == count * width * height;
+    auto black = packPixel(qd::color::black());
+    auto& tables = rgb555Tables();
+    ScratchVector<int32_t> expected(width);
+    for (size_t i=0; i<count && same; i++) {
+        auto left = static_cast<int>(i % columns) * width;
+        auto top = static_cast<int>(i / columns) * height;
+        for (int y=0; y<height && same; y++) {
+            auto offset = ((top + y) * sheetWidth + left) * 4;
+            packRgb555Row(pixels.data() + offset, mask.data() + offset, width, black, tables, expected.data());
+            same = std::equal(expected.begin(), expected.end(), decoded.begin() + (i * height + y) * width);
+        }
+    }
+    if (!same) {
+        throw std::runtime_error("Verification failed, decoded frames differ");
+    }
+}
+
+std::shared_ptr<data::data> encodeSheets(const Engine& engine, std::shared_ptr<qd::surface> sprite, uint32_t format,
+                                         std::shared_ptr<qd::surface> mask, qd::size frame) {
+    auto reduce = engine.options.dither ? selectReduceRgb555(format) : nullptr;
+    if (engine.options.stream) {
+        return streamRle(*engine.pool, sprite, mask, frame, reduce, engine.options.verify);
+    }
+    auto spriteX = sprite->size().width();
+    auto spriteY = sprite->size().height();
+    ScratchVector<uint8_t> pixels;
+    bool reduced = false;
+    if (reduce && reduce != reduceRgb555<rgb555Source>) {
+        pixels = readPixels(sprite);
+        PhaseTimer timer(ditherPhase);
+        reduced = reduce(pixels.data(), spriteX, spriteY, ditherTables(), engine.pool.get());
+    }
+
+    // Apply the mask, to a new surface as the decoded one may be shared
+    PhaseTimer maskTimer(maskPhase);
+    auto maskPixels = readPixels(mask);
+    auto black = packPixel(qd::color::black());
+    std::shared_ptr<qd::surface> masked;
+    if (reduced) {
+        for (int y=0; y<spriteY; y++) {
+            auto offset = y * spriteX * 4;
+            applyMaskRow(pixels.data() + offset, maskPixels.data() + offset, spriteX, black);
+        }
+        masked = std::make_shared<qd::surface>(spriteX, spriteY);
+        writePixels(masked, pixels);
+    } else {
+        // Left undithered, only masked pixels change, so the surface is copied whole and just those are cleared
+        masked = std::make_shared<qd::surface>(*sprite);
+        auto maskPixel = maskPixels.data();
+        for (int y=0; y<spriteY; y++) {
+            for (int x=0; x<spriteX; x++, maskPixel += 4) {
+                if (packPixel(maskPixel[0], maskPixel[1], maskPixel[2], maskPixel[3]) == black) {
+                    masked->set(x, y, qd::color(0, 0, 0, 0));
+                }
+            }
+        }
+    }
+    maskTimer.stop();
+
+    PhaseTimer encodeTimer(encodePhase);
+    auto rle = qd::rle(masked, frame).data();
+    encodeTimer.stop();
+    if (engine.options.verify) {
+        if (pixels.empty()) {
+            // The mask is applied again while checking
+            pixels = readPixels(sprite);
+        }
+        verifySheet(pixels, maskPixels, spriteX, frame, rle);
+    }
+    return rle;
+}
+
+void decodeSheets(qd::rle& rle, std::shared_ptr<data::data>& sprite, std::shared_ptr<data::data>& mask, bool verify) {
+    // Separate the mask, building the 1-bit mask directly
+    PhaseTimer maskTimer(maskPhase);
+    auto surface = rle.surface().lock();
+    auto spriteX = surface->size().width();
+    auto spriteY = surface->size().height();
+    auto pixels = readPixels(surface);
+    ScratchVector<uint8_t> original;
+    if (verify) {
+        original = pixels;
+    }
+    auto black = packPixel(qd::color::black());
+    auto rowBytes = maskRowBytes(spriteX);
+    ScratchVector<uint8_t> bits(rowBytes * spriteY);
+    for (int y=0; y<spriteY; y++) {
+        splitMaskRow(pixels.data() + y * spriteX * 4, spriteX, black, bits.data() + y * rowBytes);
+    }
+    writePixels(surface, pixels);
+    maskTimer.stop();
+
+    PhaseTimer encodeTimer(encodePhase);
+    sprite = qd::pict(surface).data(16);
+    mask = makeData(maskPict(bits.data(), spriteX, spriteY));
+    encodeTimer.stop();
+    if (verify) {
+        PhaseTimer timer(verifyPhase);
+        auto spritePixels = readPixels(qd::pict(sprite).image_surface().lock());
+        auto maskPixels = readPixels(qd::pict(mask).image_surface().lock());
+        if (spritePixels.size() != original.size() || maskPixels.size() != original.size() ||
+            !matchesSplit(original.data(), spritePixels.data(), maskPixels.data(), original.size() / 4)) {
+            throw std::runtime_error("Verification failed, decoded sprite or mask differs");
+        }
+    }
+}
+
+static bool encodeLayer(const Engine& engine, Layer& layer, DecodeCache& decodes) {
+    auto frame = layer.frame;
+    if (frame.width() <= 0 || frame.height() <= 0) {
+        layer.error = "Invalid frame size in " + ownerName(layer) + ".";
+        return false;
+    }
+
+    PhaseTimer decodeTimer(decodePhase);
+    auto spritePict = decodes.pict(layer.spriteID);
+    if (spritePict == nullptr) {
+        return false;
+    }
+    auto sprite = spritePict->surface;
+    auto spriteX = sprite->size().width();
+    auto spriteY = sprite->size().height();
+    if (spriteX % frame.width() != 0 || spriteY % frame.height() != 0) {
+        layer.error = stringf("Sprite PICT %d for %s does not match frame size.", layer.spriteID, ownerName(layer).c_str());
+        return false;
+    }
+    auto maskPict = decodes.pict(layer.maskID);
+    if (maskPict == nullptr) {
+        return false;
+    }
+    auto mask = maskPict->surface;
+    decodeTimer.stop();
+    if (!(mask->size() == sprite->size())) {
+        layer.error = stringf("Mask PICT %d for %s does not match sprite size.", layer.maskID, ownerName(layer).c_str());
+        return false;
+    }
+
+    layer.rle = encodeSheets(engine, sprite, spritePict->format, mask, frame);
+    if (engine.options.verbose) {
+        auto frames = (spriteX / frame.width()) * (spriteY / frame.height());
+        layer.row = stringf("%7lld  %7d  %6d  %6d  %6d  %11ld  %9ld  %9ld\n",
+                            layer.owner->id(), layer.spriteID, frames, frame.width(), frame.height(),
+                            spritePict->size, maskPict->size, layer.rle->size());
+    }
+    layer.name = spritePict->name;
+    return true;
+}
+
+static bool decodeLayer(const Engine& engine, Layer& layer) {
+    if (layer.gridX <= 0) {
+        layer.error = "Invalid grid size in " + ownerName(layer) + ".";
+        return false;
+    }
+
+    PhaseTimer decodeTimer(decodePhase);
+    auto rle = qd::rle(layer.source->data(), 0, "", layer.gridX);
+    decodeTimer.stop();
+    auto frame = layer.frame;
+    if (!(frame == rle.frame_size())) {
+        layer.error = stringf("rlëD %d for %s does not match frame size.", layer.spriteID, ownerName(layer).c_str());
+        return false;
+    }
+
+    decodeSheets(rle, layer.sprite, layer.mask, engine.options.verify);
+    if (engine.options.verbose) {
+        layer.row = stringf("%7lld  %7d  %6d  %6d  %6d  %11ld  %9ld  %9ld\n",
+                            layer.owner->id(), layer.spriteID, rle.frame_count(), frame.width(), frame.height(),
+                            layer.sprite->size(), layer.mask->size(), layer.source->data()->size());
+    }
+    layer.name = layer.source->name();
+    return true;
+}
+
+// Find what a layer needs and claim its sprite ID. Returns false if the layer has nothing to convert.
+static bool prepareLayer(Layer& layer, rsrc::file& file, SpriteSession& session) {
+    if (layer.spriteID <= 0 || layer.maskID <= 0 || session.converted.count(layer.spriteID)) {
+        return false;
+    }
+    if (session.encode) {
+        if (file.find("PICT", layer.spriteID, {}).expired() || file.find("PICT", layer.maskID, {}).expired()) {
+            return false;
+        }
+    } else {
+        layer.source = file.find("rlëD", layer.spriteID, {}).lock();
+        if (layer.source == nullptr) {
+            return false;
+        }
+    }
+    session.converted.insert(layer.spriteID);
+    return true;
+}
+
+static void releaseLayer(const Layer& layer, SpriteSession& session) {
+    if (session.encode) {
+        session.decodes.release(layer.spriteID);
+        session.decodes.release(layer.maskID);
+    }
+}
+
+// Convert the layers concurrently, then add the results to the file in order. Returns the number converted.
+static int processLayers(std::vector<Layer>& layers, rsrc::file& file, SpriteSession& session) {
+    auto& engine = session.context.engine;
+    bool encode = session.encode;
+    std::vector<Layer*> ready;
+    for (auto& layer : layers) {
+        if (prepareLayer(layer, file, session)) {
+            ready.push_back(&layer);
+        } else {
+            releaseLayer(layer, session);
+        }
+    }
+    auto resource = ResourceScope::current();
+    engine.pool->parallelFor(ready.size(), [&](size_t i) {
+        ResourceScope scope(resource);
+        auto& layer = *ready[i];
+        try {
+            layer.done = encode ? encodeLayer(engine, layer, session.decodes) : decodeLayer(engine, layer);
+        } catch (const std::exception& e) {
+            layer.error = ownerName(layer) + ": " + e.what();
+        }
+        releaseLayer(layer, session);
+    });
+
+    int processed = 0;
+    for (auto layer : ready) {
+        if (!layer->error.empty()) {
+            *session.context.err << layer->error << std::endl;
+        }
+        if (!layer->done) {
+            continue;
+        }
+        *session.context.out << layer->row;
+        if (encode) {
+            file.add_resource("rlëD", layer->spriteID, layer->name, layer->rle);
+            session.removals.insert({"PICT", layer->spriteID});
+            session.removals.insert({"PICT", layer->maskID});
+        } else {
+            file.add_resource("PICT", layer->spriteID, layer->name, layer->sprite);
+            file.add_resource("PICT", layer->maskID, "", layer->mask);
+            session.removals.insert({"rlëD", layer->spriteID});
+        }
+        processed++;
+    }
+    return processed;
+}
+
+static void finishSession(rsrc::file& file, SpriteSession& session) {
+    for (auto& [type, id] : session.removals) {
+        if (auto resource = file.find(type, id, {}).lock()) {
+            resource->remove();
+        }
+    }
+}
+
+static Layer spriteLayer(std::shared_ptr<rsrc::resource> resource, int16_t spriteID, int16_t maskID, qd::size frame, int16_t gridX) {
+    Layer layer;
+    layer.owner = resource;
+    layer.spriteID = spriteID;
+    layer.maskID = maskID;
+    layer.frame = frame;
+    layer.gridX = gridX;
+    return layer;
+}
+
+static SpriteLayer spriteLayer(int16_t spriteID, int16_t maskID, qd::size frame, int16_t gridX) {
+    SpriteLayer layer;
+    layer.spriteID = spriteID;
+    layer.maskID = maskID;
+    layer.frame = frame;
+    layer.gridX = gridX;
+    return layer;
+}
+
+std::vector<SpriteLayer> spriteLayers(const std::string& typeCode, std::shared_ptr<data::data> data) {
+    std::vector<SpriteLayer> layers;
+    if (typeCode == "spïn") {
+        auto spin = Spin(data);
+        layers.push_back(spriteLayer(spin.spriteID, spin.maskID, spin.frame, spin.grid.width()));
+        return layers;
+    }
+    auto shan = Shan(data);
+    // Work out a suitable grid width for decoding
+    int16_t gridX = 6;
+    if (shan.framesPer <= gridX) {
+        gridX = shan.framesPer;
+    } else {
+        while (shan.framesPer % gridX != 0) {
+            gridX += 1;
+        }
+    }
+    layers.push_back(spriteLayer(shan.baseSpriteID, shan.baseMaskID, shan.baseFrame, gridX));
+    layers.push_back(spriteLayer(shan.altSpriteID, shan.altMaskID, shan.altFrame, gridX));
+    layers.push_back(spriteLayer(shan.engineSpriteID, shan.engineMaskID, shan.engineFrame, gridX));
+    layers.push_back(spriteLayer(shan.lightSpriteID, shan.lightMaskID, shan.lightFrame, gridX));
+    layers.push_back(spriteLayer(shan.weaponSpriteID, shan.weaponMaskID, shan.weaponFrame, gridX));
+    layers.push_back(spriteLayer(shan.shieldSpriteID, shan.shieldMaskID, shan.shieldFrame, gridX));
+    return layers;
+}
+
+// The sprite layers of a spïn or shän resource
+static std::vector<Layer> resourceLayers(std::shared_ptr<rsrc::resource> resource) {
+    std::vector<Layer> layers;
+    for (auto& layer : spriteLayers(resource->type_code(), resource->data())) {
+        layers.push_back(spriteLayer(resource, layer.spriteID, layer.maskID, layer.frame, layer.gridX));
+    }
+    return layers;
+}
+
+bool enRle(const Engine& engine, std::shared_ptr<rsrc::resource> resource, rsrc::file& file, int16_t spriteID, int16_t maskID, qd::size frame) {
+    FileContext context(engine);
+    SpriteSession session(file, context, true);
+    std::vector<Layer> layers = { spriteLayer(resource, spriteID, maskID, frame, 0) };
+    bool processed = processLayers(layers, file, session);
+    finishSession(file, session);
+    return processed;
+}
+
+bool deRle(const Engine& engine, std::shared_ptr<rsrc::resource> resource, rsrc::file& file, int16_t spriteID, int16_t maskID, qd::size frame, int16_t gridX) {
+    FileContext context(engine);
+    SpriteSession session(file, context, false);
+    std::vector<Layer> layers = { spriteLayer(resource, spriteID, maskID, frame, gridX) };
+    bool processed = processLayers(layers, file, session);
+    finishSession(file, session);
+    return processed;
+}
+
+typedef struct Totals {
+    int64_t saved = 0;
+    // Portion of the savings that came from reusing the result of a duplicate payload
+    int64_t reused = 0;
+    // Resources skipped after a pre-scan
+    int skipped = 0;
+    // Resources whose new data was verified
+    int verified = 0;
+} Totals;
+
+// Times the processing of a resource when collecting stats, making it current for phase timers on this thread
+class ResourceRecord {
+public:
+    ResourceRecord(const FileContext& context, const std::string& type, int64_t id, size_t size) :
+        record(context.stats ? context.engine.stats->addResource(context.stats, type, id, size) : nullptr),
+        scope(record),
+        start(std::chrono::steady_clock::now()) {}
+
+    void finish(int64_t saved) {
+        if (record) {
+            record->nanoseconds = elapsedNanoseconds(start);
+            record->outputSize = record->inputSize - saved;
+        }
+    }
+
+private:
+    ResourceStats* record;
+    ResourceScope scope;
+    std::chrono::steady_clock::time_point start;
+};
+
+Totals processResources(std::vector<ResourcePayload>& payloads, int64_t (*process)(const Engine&, ResourcePayload&, Result&), FileContext& context) {
+    // Resources are independent so they can be spread across the pool.
+    // Output is collected and printed afterwards, in resource ID order, so it doesn't depend on scheduling.
+    auto& engine = context.engine;
+    std::vector<Result> results(payloads.size());
+    engine.pool->parallelFor(payloads.size(), [&](size_t i) {
+        auto& payload = payloads[i];
+        auto& result = results[i];
+        result.id = payload.id;
+        ResourceRecord record(context, payload.type, payload.id, payload.size);
+        try {
+            result.saved = process(engine, payload, result);
+        } catch (const std::exception& e) {
+            result.error = payload.type + " " + std::to_string(payload.id) + ": " + e.what();
+        }
+        record.finish(result.saved);
+    });
+    std::stable_sort(results.begin(), results.end(), [](const Result& a, const Result& b) {
+        return a.id < b.id;
+    });
+    Totals totals;
+    for (auto& result : results) {
+        totals.saved += result.saved;
+        if (result.reused) {
+            totals.reused += result.saved;
+        }
+        totals.skipped += result.skipped;
+        totals.verified += result.verified;
+        *context.out << result.row;
+        if (!result.error.empty()) {
+            *context.err << result.error << std::endl;
+        }
+    }
+    return totals;
+}
+
+// Summary of savings for a type, noting what came from duplicates when deduplicating
+std::string savedSummary(const Engine& engine, Totals totals, size_t count, std::string type) {
+    auto summary = "Saved " + std::to_string(totals.saved) + " bytes from " + std::to_string(count) + " " + type + "s";
+    if (engine.dedup) {
+        summary += " (" + std::to_string(totals.reused) + " bytes by reusing duplicates)";
+    }
+    if (engine.options.prescan && type == "PICT") {
+        summary += ", skipped " + std::to_string(totals.skipped) + " unchanged by pre-scan";
+    }
+    if (engine.options.verify) {
+        summary += ", verified " + std::to_string(totals.verified) + " changed";
+    }
+    return summary + ".";
+}
+
+bool processPayloads(std::string typeCode, std::vector<ResourcePayload>& payloads, FileContext& context) {
+    if (payloads.empty()) {
+        return false;
+    }
+    for (auto& payload : payloads) {
+        payload.file = context.name;
+    }
+    auto& options = context.engine.options;
+    auto& out = *context.out;
+    Totals totals;
+    if (typeCode == "rlëD") {
+        if (options.verbose) {
+            out << "rlëD ID  Frames  Height      Size  New Height  New Size   Saved  Action\n";
+        }
+        totals = processResources(payloads, processRle, context);
+    } else if (typeCode == "PICT") {
+        if (options.verbose) {
+            out << "PICT ID  Type        Size  New Type  New Size   Saved  Action\n";
+        }
+        totals = processResources(payloads, processPict, context);
+    } else {
+        return false;
+    }
+    out << savedSummary(context.engine, totals, payloads.size(), typeCode) << std::endl;
+    for (auto& payload : payloads) {
+        if (payload.output) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint64_t payloadHash(const ResourcePayload& payload) {
+    return hash64(payload.bytes, payload.size);
+}
+
+// Whether a payload is unchanged since its file was last processed
+static bool isSettled(const ResourceHashes& settled, const ResourcePayload& payload) {
+    auto hash = settled.find({payload.type, payload.id});
+    return hash != settled.end() && hash->second == payloadHash(payload);
+}
+
+ResourceHashes resourceHashes(rsrc::file& file) {
+    ResourceHashes hashes;
+    for (auto typeCode : { "rlëD", "PICT" }) {
+        for (auto resource : file.type_container(typeCode).lock()->resources()) {
+            auto payload = resourcePayload(resource);
+            hashes[{payload.type, payload.id}] = payloadHash(payload);
+        }
+    }
+    return hashes;
+}
+
+bool processType(rsrc::file& file, std::string typeCode, FileContext& context) {
+    auto typeList = file.type_container(typeCode).lock();
+    if (typeList->count() == 0) {
+        return false;
+    }
+    std::vector<std::shared_ptr<rsrc::resource>> resources;
+    std::vector<ResourcePayload> payloads;
+    for (auto resource : typeList->resources()) {
+        auto payload = resourcePayload(resource);
+        if (context.settled && isSettled(*context.settled, payload)) {
+            continue;
+        }
+        resources.push_back(resource);
+        payloads.push_back(payload);
+    }
+    // Replacing the data isn't safe during processing, so it's done afterwards
+    bool changed = processPayloads(typeCode, payloads, context);
+    for (size_t i=0; i<resources.size(); i++) {
+        if (payloads[i].output) {
+            resources[i]->set_data(payloads[i].output);
+        }
+    }
+    return changed;
+}
+
+// Convert the layers of each spïn or shän of a type, printing a summary. Returns the number of rlëDs converted.
+static int processLayouts(rsrc::file& file, std::string typeCode, SpriteSession& session) {
+    auto typeList = file.type_container(typeCode).lock();
+    if (typeList->count() == 0) {
+        return 0;
+    }
+    auto& options = session.context.engine.options;
+    auto& out = *session.context.out;
+    if (options.verbose) {
+        out << typeCode << " ID  rlëD ID  Frames   Width  Height  Sprite Size  Mask Size  rlëD Size\n";
+    }
+    int processed = 0;
+    for (auto resource : typeList->resources()) {
+        ResourceRecord record(session.context, typeCode, resource->id(), resource->data()->size());
+        try {
+            auto layers = resourceLayers(resource);
+            processed += processLayers(layers, file, session);
+        } catch (const std::exception& e) {
+            *session.context.err << typeCode << " " << resource->id() << ": " << e.what() << std::endl;
+        }
+        record.finish(0);
+    }
+    auto action = session.encode ? "Encoded" : "Decoded";
+    out << action << " " << processed << " rlëDs from " << typeList->count() << " " << typeCode << "s"
+        << (options.verify ? ", each verified." : ".") << std::endl;
+    return processed;
+}
+
+bool processSprites(rsrc::file& file, FileContext& context) {
+    auto& options = context.engine.options;
+    SpriteSession session(file, context, options.encode);
+    if (session.encode) {
+        // Count the uses of each PICT up front, so decodes shared between spïns and shäns are kept until their last use
+        for (auto typeCode : { "spïn", "shän" }) {
+            for (auto resource : file.type_container(typeCode).lock()->resources()) {
+                try {
+                    for (auto& layer : resourceLayers(resource)) {
+                        session.decodes.expect(layer.spriteID);
+                        session.decodes.expect(layer.maskID);
+                    }
+                } catch (const std::exception& e) {
+                    // Reported when it's processed
+                }
+            }
+        }
+    }
+    int processed = processLayouts(file, "spïn", session) + processLayouts(file, "shän", session);
+    finishSession(file, session);
+    if (options.verbose && session.encode && session.decodes.decodes() > 0) {
+        *context.out << "Decoded " << session.decodes.decodes() << " PICTs, reused " << session.decodes.reuses() << " decodes." << std::endl;
+    }
+    return processed != 0;
+}
+
+// Write an rlëI index for each rlëD, replacing any existing one that is out of date
+bool indexRles(rsrc::file& file, FileContext& context) {
+    auto typeList = file.type_container("rlëD").lock();
+    if (typeList->count() == 0) {
+        return false;
+    }
+    auto& options = context.engine.options;
+    auto& out = *context.out;
+    if (options.verbose) {
+        out << "rlëI ID  Frames  Height  Index Size  Blank Lines  Action\n";
+    }
+    int written = 0;
+    for (auto resource : typeList->resources()) {
+        try {
+            auto input = resource->data();
+            auto index = indexRle(dataBytes(input), input->size());
+            auto data = rleIndexData(index);
+            auto existing = file.find("rlëI", resource->id(), {}).lock();
+            bool changed = true;
+            if (existing) {
+                auto current = existing->data();
+                changed = current->size() != data.size() || memcmp(dataBytes(current), data.data(), data.size()) != 0;
+            }
+            if (options.verbose) {
+                // Lines that a trim of each frame on its own could remove
+                int64_t blank = 0;
+                for (auto& frame : index.frames) {
+                    blank += frame.top + (index.height - frame.bottom);
+                }
+                out << stringf("%7lld  %6zu  %6d  %10zu  %11lld  %s\n", resource->id(), index.frames.size(), index.height,
+                               data.size(), blank, changed ? "Written" : "Not written");
+            }
+            if (!changed) {
+                continue;
+            }
+            if (existing) {
+                existing->set_data(makeData(std::move(data)));
+            } else {
+                file.add_resource("rlëI", resource->id(), resource->name(), makeData(std::move(data)));
+            }
+            written++;
+        } catch (const std::exception& e) {
+            *context.err << "rlëD " << resource->id() << ": " << e.what() << std::endl;
+        }
+    }
+    out << "Indexed " << written << " of " << typeList->count() << " rlëDs." << std::endl;
+    return written != 0;
+}
+
+// Remove rlëIs whose rlëD is gone, and if checking their data, those that no longer match their rlëD.
+// Returns true if any were removed.
+static bool removeStaleIndexes(rsrc::file& file, FileContext& context, bool checkData) {
+    std::vector<std::shared_ptr<rsrc::resource>> stale;
+    for (auto index : file.type_container("rlëI").lock()->resources()) {
+        auto rle = file.find("rlëD", index->id(), {}).lock();
+        bool current = rle != nullptr;
+        if (current && checkData) {
+            try {
+                auto input = rle->data();
+                auto data = rleIndexData(indexRle(dataBytes(input), input->size()));
+                auto existing = index->data();
+                current = existing->size() == data.size() && memcmp(dataBytes(existing), data.data(), data.size()) == 0;
+            } catch (const std::exception& e) {
+                current = false;
+            }
+        }
+        if (!current) {
+            stale.push_back(index);
+        }
+    }
+    for (auto& index : stale) {
+        index->remove();
+    }
+    if (!stale.empty()) {
+        *context.out << "Removed " << stale.size() << " out of date rlëIs." << std::endl;
+    }
+    return !stale.empty();
+}
+
+bool transformFile(rsrc::file& file, FileContext& context) {
+    auto& options = context.engine.options;
+    bool changed = false;
+    // Process picts first if decoding rleDs, otherwise last
+    if (options.picts && options.decode) {
+        changed |= processType(file, "PICT", context);
+    }
+    // If trim is on, do encodes before processing rleDs so they can also be trimmed, otherwise encode after
+    if (options.decode || (options.encode && options.trim)) {
+        changed |= processSprites(file, context);
+    }
+    if (options.condense) {
+        changed |= processType(file, "rlëD", context);
+    }
+    if (options.encode && !options.trim) {
+        changed |= processSprites(file, context);
+    }
+    if (options.picts && !options.decode) {
+        changed |= processType(file, "PICT", context);
+    }
+    // Index last, so it describes the final rlëDs
+    if (options.index) {
+        changed |= indexRles(file, context);
+    }
+    // Indexes of rlëDs that were decoded away, or changed without being indexed again, no longer apply
+    if (changed) {
+        removeStaleIndexes(file, context, !options.index);
+    }
+    return changed;
+}
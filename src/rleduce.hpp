@@ -0,0 +1,165 @@
+//
+//  rleduce.hpp
+//  rleduce
+//
+
+#ifndef rleduce_hpp
+#define rleduce_hpp
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "libGraphite/quickdraw/rle.hpp"
+#include "libGraphite/rsrc/file.hpp"
+#include "cache.hpp"
+#include "dedup.hpp"
+#include "pool.hpp"
+#include "stats.hpp"
+
+typedef struct Options {
+    bool condense = false;
+    bool trim = false;
+    bool reencode = false;
+    bool index = false;
+    bool picts = false;
+    bool reduce = false;
+    bool encode = false;
+    bool decode = false;
+    bool dither = true;
+    bool verbose = false;
+    bool forceFormat = false;
+    graphite::rsrc::file::format format;
+    bool pipeline = false;
+    bool interleave = false;
+    bool mmap = false;
+    bool incremental = false;
+    bool stream = false;
+    bool dedup = false;
+    bool best = false;
+    bool prescan = false;
+    bool verify = false;
+    bool stats = false;
+    int jobs = 1;
+} Options;
+
+// Everything processing depends on besides its input. There's no global state, so an engine can be shared by
+// any number of threads and files at once, and separate engines can use different options side by side.
+// The cache, dedup and stats are optional.
+typedef struct Engine {
+    Options options;
+    std::unique_ptr<WorkPool> pool;
+    std::unique_ptr<ResultCache> cache;
+    std::unique_ptr<ResultDedup> dedup;
+    std::unique_ptr<StatsCollector> stats;
+
+    explicit Engine(const Options& options) : options(options), pool(std::make_unique<WorkPool>(options.jobs)) {}
+} Engine;
+
+// Hashes of a file's rlëD and PICT data by type and ID, to tell which have changed since it was processed
+typedef std::map<std::pair<std::string, int64_t>, uint64_t> ResourceHashes;
+
+// A file being processed. Its output is printed to its own streams, so files processed at the same time
+// can each be printed in one piece.
+typedef struct FileContext {
+    const Engine& engine;
+    std::string name;
+    FileStats* stats;
+    std::ostream* out;
+    std::ostream* err;
+    // When set, rlëDs and PICTs with the same data as when the file was last processed are left alone
+    const ResourceHashes* settled = nullptr;
+
+    explicit FileContext(const Engine& engine, std::string name = "", FileStats* stats = nullptr,
+                         std::ostream* out = &std::cout, std::ostream* err = &std::cerr) :
+        engine(engine), name(std::move(name)), stats(stats), out(out), err(err) {}
+} FileContext;
+
+typedef struct Result {
+    int64_t id = 0;
+    int64_t saved = 0;
+    // Whether the result was reused from a duplicate payload
+    bool reused = false;
+    // Whether a pre-scan showed processing couldn't change it
+    bool skipped = false;
+    // Whether the new data was decoded and checked against the original
+    bool verified = false;
+    std::string row;
+    std::string error;
+} Result;
+
+// A resource's data detached from where it's stored, so it can come from an rsrc::file or straight from a
+// mapped resource fork. The bytes must stay valid while it's processed.
+typedef struct ResourcePayload {
+    std::string type;
+    int64_t id = 0;
+    // Name of the file it came from, for reporting
+    std::string file;
+    const char* bytes = nullptr;
+    size_t size = 0;
+    // The same bytes as Graphite data, if that's where they came from
+    std::shared_ptr<graphite::data::data> source;
+    // Set when the resource should be rewritten with new data
+    std::shared_ptr<graphite::data::data> output;
+} ResourcePayload;
+
+std::string stringf(const char* format, ...);
+const char* dataBytes(std::shared_ptr<graphite::data::data> data);
+std::shared_ptr<graphite::data::data> makeData(std::vector<char> bytes);
+ResourcePayload resourcePayload(std::shared_ptr<graphite::rsrc::resource> resource);
+
+// Each of these returns the number of bytes saved, and fills in the result's verbose row
+int64_t processRle(const Engine& engine, ResourcePayload& payload, Result& result);
+int64_t processPict(const Engine& engine, ResourcePayload& payload, Result& result);
+
+// Dither a surface decoded from a PICT of the given format to rgb555, skipping work the format doesn't need.
+// Wide surfaces are split across the pool if given.
+void rgb555dither(std::shared_ptr<graphite::qd::surface> surface, uint32_t format = 32, WorkPool* pool = nullptr);
+
+// A sprite layer of a spïn or shän: the PICT pair it's encoded from, or the rlëD it's decoded from
+typedef struct SpriteLayer {
+    int16_t spriteID = 0;
+    int16_t maskID = 0;
+    graphite::qd::size frame;
+    // Frames per row when decoding
+    int16_t gridX = 0;
+} SpriteLayer;
+
+// The sprite layers of a spïn or shän's data. Unused layers have no sprite ID.
+std::vector<SpriteLayer> spriteLayers(const std::string& typeCode, std::shared_ptr<graphite::data::data> data);
+
+// Encode decoded sprite and mask sheets into an rlëD, dithering as the sprite PICT's format needs.
+// The sheets must be the same size and a whole number of frames. Throws if verifying and the rlëD doesn't decode
+// to the masked sprite.
+std::shared_ptr<graphite::data::data> encodeSheets(const Engine& engine, std::shared_ptr<graphite::qd::surface> sprite,
+                                                   uint32_t format, std::shared_ptr<graphite::qd::surface> mask,
+                                                   graphite::qd::size frame);
+// Decode an rlëD into a 16-bit sprite PICT and a 1-bit mask PICT. If verifying, throws if they don't decode to
+// the rlëD's pixels.
+void decodeSheets(graphite::qd::rle& rle, std::shared_ptr<graphite::data::data>& sprite,
+                  std::shared_ptr<graphite::data::data>& mask, bool verify = false);
+
+// Encode a sprite and mask PICT pair into an rlëD, or decode an rlëD back into a pair, whatever the engine's
+// -e and -d options. Returns false if nothing was converted.
+bool enRle(const Engine& engine, std::shared_ptr<graphite::rsrc::resource> resource, graphite::rsrc::file& file,
+           int16_t spriteID, int16_t maskID, graphite::qd::size frame);
+bool deRle(const Engine& engine, std::shared_ptr<graphite::rsrc::resource> resource, graphite::rsrc::file& file,
+           int16_t spriteID, int16_t maskID, graphite::qd::size frame, int16_t gridX);
+
+// Process rlëD or PICT payloads, printing a summary. Returns true if any payload has new output.
+bool processPayloads(std::string typeCode, std::vector<ResourcePayload>& payloads, FileContext& context);
+// Process every rlëD or PICT, printing a summary. Returns true if anything changed.
+bool processType(graphite::rsrc::file& file, std::string typeCode, FileContext& context);
+// Encode or decode the rlëDs of every spïn and shän, converting their layers concurrently and decoding
+// each PICT only once. Returns true if anything changed.
+bool processSprites(graphite::rsrc::file& file, FileContext& context);
+bool indexRles(graphite::rsrc::file& file, FileContext& context);
+
+ResourceHashes resourceHashes(graphite::rsrc::file& file);
+
+// Process all selected types, in the order required by the options. Returns true if anything changed.
+bool transformFile(graphite::rsrc::file& file, FileContext& context);
+
+#endif /* rleduce_hpp */
@@ -0,0 +1,209 @@
+//
+//  stats.cpp
+//  rleduce
+//
+
+#include <map>
+#include <sys/resource.h>
+#include "stats.hpp"
+
+static const char* phaseNames[phaseCount] = { "parse", "decode", "dither", "mask", "encode", "verify", "write" };
+
+static thread_local ResourceStats* currentResource = nullptr;
+
+int64_t elapsedNanoseconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+int64_t peakMemory() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    // Linux reports kilobytes
+    return usage.ru_maxrss * 1024;
+#endif
+}
+
+ResourceScope::ResourceScope(ResourceStats* resource) : previous(currentResource) {
+    currentResource = resource;
+}
+
+ResourceScope::~ResourceScope() {
+    currentResource = previous;
+}
+
+ResourceStats* ResourceScope::current() {
+    return currentResource;
+}
+
+PhaseTimer::PhaseTimer(StatsPhase phase, FileStats* file) : phase(phase) {
+    times = file ? &file->phases : currentResource ? &currentResource->phases : nullptr;
+    if (times) {
+        start = std::chrono::steady_clock::now();
+    }
+}
+
+PhaseTimer::~PhaseTimer() {
+    stop();
+}
+
+void PhaseTimer::stop() {
+    if (times) {
+        (*times)[phase] += elapsedNanoseconds(start);
+        times = nullptr;
+    }
+}
+
+StatsCollector::StatsCollector() : start(std::chrono::steady_clock::now()) {}
+
+FileStats* StatsCollector::addFile(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    files.push_back(std::make_unique<FileStats>());
+    files.back()->name = name;
+    return files.back().get();
+}
+
+ResourceStats* StatsCollector::addResource(FileStats* file, const std::string& type, int64_t id, int64_t inputSize) {
+    std::lock_guard<std::mutex> lock(mutex);
+    file->resources.push_back(std::make_unique<ResourceStats>());
+    auto resource = file->resources.back().get();
+    resource->type = type;
+    resource->id = id;
+    resource->inputSize = inputSize;
+    return resource;
+}
+
+void StatsCollector::finishFile(FileStats* file) {
+    int64_t total = 0;
+    for (auto& phase : file->phases) {
+        total += phase;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& resource : file->resources) {
+        total += resource->nanoseconds;
+    }
+    file->nanoseconds = total;
+    file->peakMemory = peakMemory();
+}
+
+// Totals for a group of resources
+typedef struct Aggregate {
+    int64_t count = 0;
+    int64_t inputSize = 0;
+    int64_t outputSize = 0;
+    int64_t nanoseconds = 0;
+    std::array<int64_t, phaseCount> phases{};
+
+    void add(const ResourceStats& resource) {
+        count++;
+        inputSize += resource.inputSize;
+        outputSize += resource.outputSize;
+        nanoseconds += resource.nanoseconds;
+        for (int i=0; i<phaseCount; i++) {
+            phases[i] += resource.phases[i];
+        }
+    }
+} Aggregate;
+
+static std::string jsonString(const std::string& value) {
+    std::string out = "\"";
+    for (unsigned char c : value) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            out += escape;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+static std::string seconds(int64_t nanoseconds) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.6f", nanoseconds / 1e9);
+    return buffer;
+}
+
+template <typename Times>
+static void writePhases(std::ostream& out, const Times& phases) {
+    out << "{";
+    for (int i=0; i<phaseCount; i++) {
+        out << (i ? ", " : "") << jsonString(phaseNames[i]) << ": " << seconds(phases[i]);
+    }
+    out << "}";
+}
+
+static void writeTypes(std::ostream& out, const std::map<std::string, Aggregate>& types, const std::string& indent) {
+    out << "{";
+    bool first = true;
+    for (auto& [type, aggregate] : types) {
+        out << (first ? "\n" : ",\n") << indent << "  " << jsonString(type) << ": {\"count\": " << aggregate.count
+            << ", \"inputBytes\": " << aggregate.inputSize << ", \"outputBytes\": " << aggregate.outputSize
+            << ", \"seconds\": " << seconds(aggregate.nanoseconds) << ", \"phases\": ";
+        writePhases(out, aggregate.phases);
+        out << "}";
+        first = false;
+    }
+    out << (first ? "}" : "\n" + indent + "}");
+}
+
+void StatsCollector::writeJson(std::ostream& out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<std::string, Aggregate> types;
+    std::array<int64_t, phaseCount> phases{};
+    for (auto& file : files) {
+        for (int i=0; i<phaseCount; i++) {
+            phases[i] += file->phases[i];
+        }
+        for (auto& resource : file->resources) {
+            types[resource->type].add(*resource);
+            for (int i=0; i<phaseCount; i++) {
+                phases[i] += resource->phases[i];
+            }
+        }
+    }
+
+    out << "{\n";
+    out << "  \"seconds\": " << seconds(elapsedNanoseconds(start)) << ",\n";
+    out << "  \"peakMemory\": " << peakMemory() << ",\n";
+    out << "  \"phases\": ";
+    writePhases(out, phases);
+    out << ",\n  \"types\": ";
+    writeTypes(out, types, "  ");
+    out << ",\n  \"files\": [";
+    for (size_t f=0; f<files.size(); f++) {
+        auto& file = files[f];
+        std::map<std::string, Aggregate> fileTypes;
+        for (auto& resource : file->resources) {
+            fileTypes[resource->type].add(*resource);
+        }
+        out << (f ? ",\n" : "\n") << "    {\n";
+        out << "      \"name\": " << jsonString(file->name) << ",\n";
+        out << "      \"seconds\": " << seconds(file->nanoseconds) << ",\n";
+        out << "      \"peakMemory\": " << file->peakMemory << ",\n";
+        out << "      \"phases\": ";
+        writePhases(out, file->phases);
+        out << ",\n      \"types\": ";
+        writeTypes(out, fileTypes, "      ");
+        out << ",\n      \"resources\": [";
+        for (size_t r=0; r<file->resources.size(); r++) {
+            auto& resource = file->resources[r];
+            out << (r ? ",\n" : "\n") << "        {\"type\": " << jsonString(resource->type)
+                << ", \"id\": " << resource->id << ", \"inputBytes\": " << resource->inputSize
+                << ", \"outputBytes\": " << resource->outputSize << ", \"seconds\": " << seconds(resource->nanoseconds)
+                << ", \"phases\": ";
+            writePhases(out, resource->phases);
+            out << "}";
+        }
+        out << (file->resources.empty() ? "]" : "\n      ]") << "\n    }";
+    }
+    out << (files.empty() ? "]" : "\n  ]") << "\n}\n";
+}
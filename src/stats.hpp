@@ -0,0 +1,103 @@
+//
+//  stats.hpp
+//  rleduce
+//
+
+#ifndef stats_hpp
+#define stats_hpp
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+enum StatsPhase {
+    parsePhase,
+    decodePhase,
+    ditherPhase,
+    maskPhase,
+    encodePhase,
+    verifyPhase,
+    writePhase,
+    phaseCount
+};
+
+// Nanoseconds spent in each phase. Atomic since a resource's work may be spread across the pool.
+typedef std::array<std::atomic<int64_t>, phaseCount> PhaseTimes;
+
+typedef struct ResourceStats {
+    std::string type;
+    int64_t id = 0;
+    int64_t inputSize = 0;
+    int64_t outputSize = 0;
+    int64_t nanoseconds = 0;
+    PhaseTimes phases{};
+} ResourceStats;
+
+typedef struct FileStats {
+    std::string name;
+    // Time spent on the file's parse, write and resources, summed across threads
+    int64_t nanoseconds = 0;
+    // Process peak resident memory once the file was done
+    int64_t peakMemory = 0;
+    // Parse and write times are recorded against the file, everything else against its resources
+    PhaseTimes phases{};
+    std::vector<std::unique_ptr<ResourceStats>> resources;
+} FileStats;
+
+// Collects timings for a run, for output as JSON.
+// Files may be at different stages at once when pipelining, so each is tracked separately.
+class StatsCollector {
+public:
+    StatsCollector();
+
+    FileStats* addFile(const std::string& name);
+    ResourceStats* addResource(FileStats* file, const std::string& type, int64_t id, int64_t inputSize);
+    void finishFile(FileStats* file);
+
+    void writeJson(std::ostream& out);
+
+private:
+    std::mutex mutex;
+    std::chrono::steady_clock::time_point start;
+    std::vector<std::unique_ptr<FileStats>> files;
+};
+
+// Process peak resident memory in bytes
+int64_t peakMemory();
+
+int64_t elapsedNanoseconds(std::chrono::steady_clock::time_point start);
+
+// Makes a resource current on this thread, so phase timers are recorded against it
+class ResourceScope {
+public:
+    ResourceScope(ResourceStats* resource);
+    ~ResourceScope();
+
+    // The resource current on this thread, to carry over to tasks run on other threads
+    static ResourceStats* current();
+
+private:
+    ResourceStats* previous;
+};
+
+// Adds the time until it goes out of scope to a phase, of the given file or otherwise the current resource.
+// Does nothing when there is neither.
+class PhaseTimer {
+public:
+    PhaseTimer(StatsPhase phase, FileStats* file = nullptr);
+    ~PhaseTimer();
+    // Record the time so far and stop, for phases that don't end with a scope
+    void stop();
+
+private:
+    PhaseTimes* times;
+    StatsPhase phase;
+    std::chrono::steady_clock::time_point start;
+};
+
+#endif /* stats_hpp */
@@ -0,0 +1,153 @@
+//
+//  watch.cpp
+//  rleduce
+//
+
+#include <stdexcept>
+#include <thread>
+#include "watch.hpp"
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// How long the tree must be quiet before changes are reported, in milliseconds
+static const int settleTime = 100;
+
+static bool isHidden(const std::filesystem::path& path) {
+    auto name = path.filename().generic_string();
+    return !name.empty() && name[0] == '.';
+}
+
+std::vector<std::filesystem::path> watchedFiles(const std::filesystem::path& directory) {
+    std::vector<std::filesystem::path> files;
+    std::error_code error;
+    auto options = std::filesystem::directory_options::skip_permission_denied;
+    for (auto it = std::filesystem::recursive_directory_iterator(directory, options, error);
+         it != std::filesystem::recursive_directory_iterator(); it.increment(error)) {
+        if (error) {
+            break;
+        }
+        if (isHidden(it->path())) {
+            if (it->is_directory(error)) {
+                it.disable_recursion_pending();
+            }
+            continue;
+        }
+        if (it->is_regular_file(error)) {
+            files.push_back(it->path());
+        }
+    }
+    return files;
+}
+
+#ifdef __linux__
+
+DirectoryWatcher::DirectoryWatcher(std::filesystem::path directory) : directory(directory) {
+    fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("Could not watch directory");
+    }
+    addDirectory(directory);
+}
+
+DirectoryWatcher::~DirectoryWatcher() {
+    close(fd);
+}
+
+void DirectoryWatcher::addDirectory(const std::filesystem::path& path) {
+    auto wd = inotify_add_watch(fd, path.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (wd < 0) {
+        return;
+    }
+    directories[wd] = path;
+    std::error_code error;
+    for (auto& entry : std::filesystem::directory_iterator(path, error)) {
+        if (entry.is_directory(error) && !entry.is_symlink(error) && !isHidden(entry.path())) {
+            addDirectory(entry.path());
+        }
+    }
+}
+
+bool DirectoryWatcher::readEvents(int timeout, std::set<std::filesystem::path>& changed) {
+    pollfd request = { fd, POLLIN, 0 };
+    if (poll(&request, 1, timeout) <= 0) {
+        return false;
+    }
+    alignas(inotify_event) char buffer[16384];
+    auto length = read(fd, buffer, sizeof(buffer));
+    for (char* next = buffer; length > 0 && next < buffer + length;) {
+        auto event = reinterpret_cast<inotify_event*>(next);
+        next += sizeof(inotify_event) + event->len;
+        auto directory = directories.find(event->wd);
+        if (directory == directories.end() || event->len == 0) {
+            continue;
+        }
+        auto path = directory->second / event->name;
+        if (isHidden(path)) {
+            continue;
+        }
+        if (event->mask & IN_ISDIR) {
+            // Watch new directories. Files written before the watch is added are picked up by the next write.
+            if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                addDirectory(path);
+            }
+        } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+            changed.insert(path);
+        }
+    }
+    return true;
+}
+
+std::vector<std::filesystem::path> DirectoryWatcher::wait() {
+    std::set<std::filesystem::path> changed;
+    while (changed.empty()) {
+        readEvents(-1, changed);
+    }
+    while (readEvents(settleTime, changed)) {}
+    return std::vector<std::filesystem::path>(changed.begin(), changed.end());
+}
+
+#else
+
+DirectoryWatcher::DirectoryWatcher(std::filesystem::path directory) : directory(directory) {
+    if (!std::filesystem::is_directory(directory)) {
+        throw std::runtime_error("Could not watch directory");
+    }
+    scan();
+}
+
+DirectoryWatcher::~DirectoryWatcher() {}
+
+std::set<std::filesystem::path> DirectoryWatcher::scan() {
+    std::set<std::filesystem::path> changed;
+    for (auto& path : watchedFiles(directory)) {
+        std::error_code error;
+        auto time = std::filesystem::last_write_time(path, error);
+        if (error) {
+            continue;
+        }
+        auto [known, inserted] = times.try_emplace(path, time);
+        if (inserted || known->second != time) {
+            known->second = time;
+            changed.insert(path);
+        }
+    }
+    return changed;
+}
+
+std::vector<std::filesystem::path> DirectoryWatcher::wait() {
+    std::set<std::filesystem::path> changed;
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(settleTime * 5));
+        auto found = scan();
+        if (found.empty() && !changed.empty()) {
+            break;
+        }
+        changed.insert(found.begin(), found.end());
+    }
+    return std::vector<std::filesystem::path>(changed.begin(), changed.end());
+}
+
+#endif
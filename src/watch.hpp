@@ -0,0 +1,46 @@
+//
+//  watch.hpp
+//  rleduce
+//
+
+#ifndef watch_hpp
+#define watch_hpp
+
+#include <filesystem>
+#include <map>
+#include <set>
+#include <vector>
+
+// The files in a directory tree, skipping hidden files and directories
+std::vector<std::filesystem::path> watchedFiles(const std::filesystem::path& directory);
+
+// Reports files in a directory tree as they're written. Uses inotify on Linux and polls modification times
+// elsewhere.
+class DirectoryWatcher {
+public:
+    explicit DirectoryWatcher(std::filesystem::path directory);
+    ~DirectoryWatcher();
+    DirectoryWatcher(const DirectoryWatcher&) = delete;
+
+    // Wait for files to be written and return each one once. Writes are gathered until the tree has been quiet
+    // for a moment, so a file saved in several steps is only returned once it's complete.
+    std::vector<std::filesystem::path> wait();
+
+private:
+    std::filesystem::path directory;
+#ifdef __linux__
+    int fd = -1;
+    std::map<int, std::filesystem::path> directories;
+
+    void addDirectory(const std::filesystem::path& path);
+    // Add files written within the timeout, in milliseconds or -1 to wait indefinitely. Returns false on timeout.
+    bool readEvents(int timeout, std::set<std::filesystem::path>& changed);
+#else
+    std::map<std::filesystem::path, std::filesystem::file_time_type> times;
+
+    // Files that are new or modified since the last scan
+    std::set<std::filesystem::path> scan();
+#endif
+};
+
+#endif /* watch_hpp */